@@ -0,0 +1,52 @@
+#include "aligner.h"
+#include "viterbi.h"
+#include "logger.h"
+#include "workers.h"
+
+#define DefaultMaxPendingPerThread 4
+
+// machine is null if eval was not made from one
+template<class Cell>
+static MachinePath viterbiPath (const Machine* machine, const EvaluatedMachine& eval, const SeqPair& seqPair, const DPOptions& dpOptions) {
+  ViterbiMatrix<Cell> viterbi (eval, seqPair, dpOptions);
+  return machine ? viterbi.path (*machine) : viterbi.path();
+}
+
+static MachinePath viterbiPath (const Machine* machine, const EvaluatedMachine& eval, const SeqPair& seqPair, const DPOptions& dpOptions) {
+  return dpOptions.singlePrecision
+    ? viterbiPath<float> (machine, eval, seqPair, dpOptions)
+    : viterbiPath<double> (machine, eval, seqPair, dpOptions);
+}
+
+MachineAligner::MachineAligner() :
+  threads (1),
+  maxPending (DefaultMaxPendingPerThread)
+{ }
+
+void MachineAligner::align (const SeqPairList& data, ostream& out) const {
+  const EvaluatedMachine eval = factored ? factored->evaluate (params) : EvaluatedMachine (machine, params);
+  const Machine* pathMachine = factored ? NULL : &machine;
+  const size_t nSeqPairs = data.seqPairs.size();
+  const size_t nThreads = max ((size_t) 1, min (threads, nSeqPairs));
+  out << "[";
+  if (nThreads == 1) {
+    size_t n = 0;
+    for (const auto& seqPair: data.seqPairs) {
+      const MachinePath path = viterbiPath (pathMachine, eval, seqPair, dpOptions);
+      out << (n++ ? ",\n " : "");
+      path.writeJson (out);
+    }
+  } else {
+    // the calling thread writes the paths out in input order, as the workers finish them
+    vguard<const SeqPair*> seqPairPtr;
+    for (const auto& seqPair: data.seqPairs)
+      seqPairPtr.push_back (&seqPair);
+    runInOrder<MachinePath> (nSeqPairs, nThreads, nThreads * max ((size_t) 1, maxPending), "Viterbi",
+			     [&] (size_t n) { return viterbiPath (pathMachine, eval, *seqPairPtr[n], dpOptions); },
+			     [&] (size_t n, const MachinePath& path) {
+			       out << (n ? ",\n " : "");
+			       path.writeJson (out);
+			     });
+  }
+  out << "]\n";
+}
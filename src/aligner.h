@@ -0,0 +1,25 @@
+#ifndef ALIGNER_INCLUDED
+#define ALIGNER_INCLUDED
+
+#include <memory>
+#include "machine.h"
+#include "factored.h"
+#include "params.h"
+#include "seqpair.h"
+#include "dpmatrix.h"
+
+struct MachineAligner {
+  Machine machine;
+  shared_ptr<const FactoredComposition> factored;  // if set, sequences are aligned to this composition instead of machine, without building it
+  Params params;
+  size_t threads;  // number of Viterbi worker threads
+  size_t maxPending;  // size of reorder buffer (maximum number of paths computed but not yet written), per thread
+  DPOptions dpOptions;
+
+  MachineAligner();
+
+  // writes a JSON array of Viterbi paths, in the same order as the input sequence pairs
+  void align (const SeqPairList& data, ostream& out) const;
+};
+
+#endif /* ALIGNER_INCLUDED */
@@ -1,58 +1,55 @@
 #include "backward.h"
 #include "logger.h"
 
-BackwardMatrix::BackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
-  DPMatrix (machine, seqPair)
+// The X-drop envelope is found by the Forward fill, so in X-drop mode a standalone Backward matrix needs a Forward pass first
+template<class Cell>
+BackwardMatrix<Cell>::BackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  DPMatrix<Cell> (machine, seqPair, options, options.xDrop > 0 ? ForwardMatrix<Cell>(machine,seqPair,options).envelope() : DPEnvelope())
 {
-  for (InputIndex inPos = inLen; inPos >= 0; --inPos) {
-    const bool endOfInput = (inPos == inLen);
-    const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
-    for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
-      const bool endOfOutput = (outPos == outLen);
-      const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
-      for (int s = nStates - 1; s >= 0; --s) {
-	const bool endState = (s == nStates - 1);
-	const EvaluatedMachineState& state = machine.state[(StateIndex) s];
-	double ll = (endOfInput && endOfOutput && endState) ? 0 : -numeric_limits<double>::infinity();
-	if (!endOfInput && !endOfOutput)
-	  accumulate (ll, state.outgoing, inTok, outTok, inPos + 1, outPos + 1, sum_reduce);
-	if (!endOfInput)
-	  accumulate (ll, state.outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos, sum_reduce);
-	if (!endOfOutput)
-	  accumulate (ll, state.outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1, sum_reduce);
-	accumulate (ll, state.outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, sum_reduce);
-	cell(inPos,outPos,(StateIndex) s) = ll;
-      }
-    }
-  }
+  this->template fillOutgoing<SumProductSemiring>();
   LogThisAt(8,"Backward matrix:" << endl << *this);
 }
 
-double BackwardMatrix::logLike() const {
-  return cell (0, 0, machine.startState());
+template<class Cell>
+BackwardMatrix<Cell>::BackwardMatrix (const ForwardMatrix<Cell>& forward) :
+  DPMatrix<Cell> (forward.machine, forward.seqPair, forward.options, forward.envelope())
+{
+  this->template fillOutgoing<SumProductSemiring>();
+  LogThisAt(8,"Backward matrix:" << endl << *this);
 }
 
-void BackwardMatrix::getCounts (const ForwardMatrix& forward, MachineCounts& counts) const {
-  const double ll = logLike();
-  for (InputIndex inPos = inLen; inPos >= 0; --inPos) {
-    const bool endOfInput = (inPos == inLen);
-    const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
-    for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
-      const bool endOfOutput = (outPos == outLen);
-      const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
-      for (int s = nStates - 1; s >= 0; --s) {
-	const bool endState = (s == nStates - 1);
-	const EvaluatedMachineState& state = machine.state[(StateIndex) s];
-	const double logOddsRatio = forward.cell(inPos,outPos,(StateIndex) s) - ll;
-	vguard<double>& transCounts = counts.count[(StateIndex) s];
-	if (!endOfInput && !endOfOutput)
-	  accumulateCounts (logOddsRatio, transCounts, state.outgoing, inTok, outTok, inPos + 1, outPos + 1);
-	if (!endOfInput)
-	  accumulateCounts (logOddsRatio, transCounts, state.outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
-	if (!endOfOutput)
-	  accumulateCounts (logOddsRatio, transCounts, state.outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
-	accumulateCounts (logOddsRatio, transCounts, state.outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
-      }
-    }
+// Each row is filled, then its counts are accumulated using the same row of the Forward matrix, refilled from its checkpoint if necessary.
+// Counts are normalized by the Forward log-likelihood, since the Backward one is only known once the fill is complete
+template<class Cell>
+BackwardMatrix<Cell>::BackwardMatrix (ForwardMatrix<Cell>& forward, MachineCounts& counts) :
+  DPMatrix<Cell> (forward.machine, forward.seqPair, forward.options, forward.envelope(), true)
+{
+  const double ll = forward.logLike();
+  for (InputIndex row = this->inLen; row >= 0; --row) {
+    forward.storeRow (row);
+    this->layoutRollingRow (row);
+    this->template fillOutgoingRows<SumProductSemiring> (row, row + 1);
+    this->sweepOutgoing (row, row + 1, [&] (const EvaluatedTrans& trans, const Cell* destCell, InputIndex inPos, OutputIndex outPos) {
+	counts.count[trans.src][trans.transIndex] += exp (forward.storedCell (inPos, outPos, trans.src) - ll + (destCell[trans.dest] + trans.logWeight));
+      }, true);
   }
 }
+
+template<class Cell>
+double BackwardMatrix<Cell>::logLike() const {
+  return this->cell (0, 0, this->machine.startState());
+}
+
+template<class Cell>
+void BackwardMatrix<Cell>::getCounts (const ForwardMatrix<Cell>& forward, MachineCounts& counts) const {
+  Assert (!forward.checkpointed(), "Forward matrix must store every row");
+  const double ll = logLike();
+  // posterior-counting sweep: same traversal as the Backward fill, but accumulating exp(F(src)+weight+B(dest)-logLike) for each transition.
+  // This is always serial, since every cell adds to the same counts
+  this->sweepOutgoing (0, this->inLen + 1, [&] (const EvaluatedTrans& trans, const Cell* destCell, InputIndex inPos, OutputIndex outPos) {
+      counts.count[trans.src][trans.transIndex] += exp (forward.storedCell (inPos, outPos, trans.src) - ll + (destCell[trans.dest] + trans.logWeight));
+    }, true);
+}
+
+template class BackwardMatrix<float>;
+template class BackwardMatrix<double>;
@@ -4,16 +4,15 @@
 #include "forward.h"
 #include "counts.h"
 
-class BackwardMatrix : public DPMatrix {
-private:
-  inline void accumulateCounts (double logOddsRatio, vguard<double>& transCounts, const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
-    auto visit = [&] (StateIndex, EvaluatedMachineState::TransIndex ti, double tll) { transCounts[ti] += exp (logOddsRatio + tll); };
-    iterate (inOutStateTransMap, inTok, outTok, inPos, outPos, visit);
-  }
-
+template<class Cell>
+class BackwardMatrix : public DPMatrix<Cell> {
 public:
-  BackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair);
-  void getCounts (const ForwardMatrix&, MachineCounts&) const;
+  typedef typename DPMatrix<Cell>::InputIndex InputIndex;
+  typedef typename DPMatrix<Cell>::OutputIndex OutputIndex;
+  BackwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options = DPOptions());
+  BackwardMatrix (const ForwardMatrix<Cell>& forward);  // uses the same envelope as the Forward matrix
+  BackwardMatrix (ForwardMatrix<Cell>& forward, MachineCounts& counts);  // accumulates counts during the fill, storing only two rows; the Forward matrix may be checkpointed
+  void getCounts (const ForwardMatrix<Cell>&, MachineCounts&) const;
   double logLike() const;
 };
 
@@ -2,6 +2,7 @@
 #include <gsl/gsl_multimin.h>
 #include "counts.h"
 #include "backward.h"
+#include "scaled.h"
 #include "util.h"
 #include "logger.h"
 
@@ -21,10 +22,10 @@ MachineCounts::MachineCounts (const EvaluatedMachine& machine) {
   init (machine);
 }
 
-MachineCounts::MachineCounts (const EvaluatedMachine& machine, const SeqPair& seqPair)
+MachineCounts::MachineCounts (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options)
 {
   init (machine);
-  (void) add (machine, seqPair);
+  (void) add (machine, seqPair, options);
 }
 
 void MachineCounts::init (const EvaluatedMachine& machine) {
@@ -33,13 +34,46 @@ void MachineCounts::init (const EvaluatedMachine& machine) {
     count[s].resize (machine.state[s].nTransitions, 0.);
 }
 
-double MachineCounts::add (const EvaluatedMachine& machine, const SeqPair& seqPair) {
-  const ForwardMatrix forward (machine, seqPair);
-  const BackwardMatrix backward (machine, seqPair);
-  backward.getCounts (forward, *this);
+// With a memory limit, the Forward matrix is checkpointed and the Backward matrix keeps only two rows.
+// The rolling Backward fill recomputes the Forward blocks down to row 0, after which the last row is no longer stored, so the log-likelihood is read first
+template<class Cell>
+static double addCounts (MachineCounts& counts, const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) {
+  ForwardMatrix<Cell> forward (machine, seqPair, options);
+  if (options.blockBytes) {
+    const double logLike = forward.logLike();
+    const BackwardMatrix<Cell> backward (forward, counts);
+    return logLike;
+  }
+  const BackwardMatrix<Cell> backward (forward);
+  backward.getCounts (forward, counts);
   return forward.logLike();
 }
 
+// The scaled engine's counts are only added once both of its matrices are known to be free of underflow
+static bool addScaledCounts (MachineCounts& counts, const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options, double& logLike) {
+  const ScaledForwardMatrix forward (machine, seqPair, options);
+  if (forward.underflow)
+    return false;
+  const ScaledBackwardMatrix backward (forward);
+  if (backward.underflow)
+    return false;
+  backward.getCounts (forward, counts);
+  logLike = forward.logLike();
+  return true;
+}
+
+double MachineCounts::add (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) {
+  double logLike;
+  if (options.scaled) {
+    if (addScaledCounts (*this, machine, seqPair, options, logLike))
+      return logLike;
+    LogThisAt(6,"Underflow in scaled Forward-Backward for " << seqPair.input.name << " and " << seqPair.output.name << "; falling back to log space" << endl);
+  }
+  return options.singlePrecision
+    ? addCounts<float> (*this, machine, seqPair, options)
+    : addCounts<double> (*this, machine, seqPair, options);
+}
+
 MachineCounts& MachineCounts::operator+= (const MachineCounts& counts) {
   for (StateIndex s = 0; s < count.size(); ++s)
     for (size_t t = 0; t < count[s].size(); ++t)
@@ -54,22 +88,28 @@ void MachineCounts::writeJson (ostream& outs) const {
   outs << "[" << join (s, ",\n ") << "]" << endl;
 }
 
+// Every transition weight is compiled into one tape, and a single backward sweep, with each transition's result weighted by its count over its weight,
+// gives sum_t count_t * d(log w_t)/d(param) for all parameters at once
 map<string,double> MachineCounts::paramCounts (const Machine& machine, const ParamAssign& prob) const {
-  map<string,double> paramCount;
   Assert (count.size() == machine.state.size(), "Number of states mismatch");
+  const WeightTape tape = EvaluatedMachine::compileWeights (machine, prob.defs);
+  vguard<double> paramValue, reg, grad;
+  if (!tape.slotValues (prob.defs, paramValue))
+    Abort ("Parameters don't match the compiled transition weights");
+  tape.eval (paramValue, reg);
+  vguard<double> resultWeight;
+  resultWeight.reserve (tape.result.size());
   for (StateIndex s = 0; s < machine.nStates(); ++s) {
-    auto transIter = machine.state[s].trans.begin();
     Assert (count[s].size() == machine.state[s].trans.size(), "State size mismatch");
-    for (auto& c: count[s]) {
-      auto& trans = *(transIter++);
-      const auto transParams = WeightAlgebra::params (trans.weight, ParamDefs());
-      const double w = WeightAlgebra::eval (trans.weight, prob.defs);
-      for (auto& p: transParams) {
-	const auto deriv = WeightAlgebra::deriv (trans.weight, ParamDefs(), p);
-	paramCount[p] += c * WeightAlgebra::eval (deriv, prob.defs) * prob.defs.at(p).get<double>() / w;
-      }
-    }
+    for (double c: count[s])
+      resultWeight.push_back (c / tape.value (reg, resultWeight.size()));
   }
+  tape.sumGradient (reg, resultWeight, grad);
+  // only the parameters that some transition weight uses have counts
+  map<string,double> paramCount;
+  for (const auto& in: tape.instr)
+    if (in.op == WeightTape::Param)
+      paramCount[tape.paramName[in.x]] = grad[in.x] * paramValue[in.x];
   return paramCount;
 }
 
@@ -130,9 +170,9 @@ MachineObjective::MachineObjective (const Machine& machine, const MachineCounts&
   allDefs = constantDefs;
   allDefs.insert (paramTransformDefs.begin(), paramTransformDefs.end());
 
-  deriv.reserve (transformedParam.size());
-  for (const auto& p: transformedParam)
-    deriv.push_back (WeightAlgebra::deriv (objective, allDefs, p));
+  tape = WeightTape (allDefs, transformedParam);
+  tape.compile (objective);
+  LogThisAt (6, "Compiled objective to " << tape.instr.size() << " instructions" << endl);
 
   LogThisAt (5, toString());
 }
@@ -140,7 +180,7 @@ MachineObjective::MachineObjective (const Machine& machine, const MachineCounts&
 string MachineObjective::toString() const {
   string s = string("E = ") + WeightAlgebra::toString(objective,allDefs) + "\n";
   for (size_t n = 0; n < transformedParam.size(); ++n)
-    s += "dE/d" + transformedParam[n] + " = " + WeightAlgebra::toString(deriv[n],allDefs) + "\n";
+    s += "dE/d" + transformedParam[n] + " = " + WeightAlgebra::toString(WeightAlgebra::deriv(objective,allDefs,transformedParam[n]),allDefs) + "\n";
   return s;
 }
 
@@ -152,35 +192,39 @@ Params gsl_vector_to_params (const gsl_vector *v, const MachineObjective& ml) {
   return p;
 }
 
+// The GSL callbacks evaluate the compiled tape, with the transformed parameters as its slots.
+// The gradient is found by reverse-mode differentiation, which costs about the same as one evaluation, whatever the number of parameters
 double gsl_machine_objective (const gsl_vector *v, void *voidML)
 {
   const MachineObjective& ml (*((MachineObjective*)voidML));
-  const Params pv = gsl_vector_to_params (v, ml);
+  const double f = ml.tape.eval (gsl_vector_to_stl(v));
 
-  const double f = WeightAlgebra::eval (ml.objective, pv.defs);
-
-  LogThisAt (4, JsonLoader<Params>::toJsonString(pv) << endl);
+  LogThisAt (4, JsonLoader<Params>::toJsonString(gsl_vector_to_params (v, ml)) << endl);
   LogThisAt (5, "gsl_machine_objective(" << to_string_join(gsl_vector_to_stl(v)) << ") = " << f << endl);
 
   return f;
 }
 
-void gsl_machine_objective_deriv (const gsl_vector *v, void *voidML, gsl_vector *df)
+double gsl_machine_objective_gradient (const gsl_vector *v, const MachineObjective& ml, gsl_vector *df)
 {
-  const MachineObjective& ml (*((MachineObjective*)voidML));
-  const Params pv = gsl_vector_to_params (v, ml);
-
+  vguard<double> grad;
+  const double f = ml.tape.gradient (gsl_vector_to_stl(v), grad);
   for (size_t n = 0; n < ml.transformedParam.size(); ++n)
-    gsl_vector_set (df, n, WeightAlgebra::eval (ml.deriv[n], pv.defs));
+    gsl_vector_set (df, n, grad[n]);
 
-  const vguard<double> v_stl = gsl_vector_to_stl(v), df_stl = gsl_vector_to_stl(df);
-  LogThisAt (5, "gsl_machine_objective_deriv(" << to_string_join(v_stl) << ") = (" << to_string_join(df_stl) << ")" << endl);
+  LogThisAt (5, "gsl_machine_objective_deriv(" << to_string_join(gsl_vector_to_stl(v)) << ") = (" << to_string_join(grad) << ")" << endl);
+  return f;
+}
+
+void gsl_machine_objective_deriv (const gsl_vector *v, void *voidML, gsl_vector *df)
+{
+  (void) gsl_machine_objective_gradient (v, *((MachineObjective*)voidML), df);
 }
 
 void gsl_machine_objective_with_deriv (const gsl_vector *x, void *voidML, double *f, gsl_vector *df)
 {
-  *f = gsl_machine_objective (x, voidML);
-  gsl_machine_objective_deriv (x, voidML, df);
+  *f = gsl_machine_objective_gradient (x, *((MachineObjective*)voidML), df);
+  LogThisAt (5, "gsl_machine_objective(" << to_string_join(gsl_vector_to_stl(x)) << ") = " << *f << endl);
 }
 
 Params MachineObjective::optimize (const Params& seed) const {
@@ -2,17 +2,19 @@
 #define COUNTS_INCLUDED
 
 #include "eval.h"
+#include "dpmatrix.h"
 #include "seqpair.h"
 #include "constraints.h"
+#include "tape.h"
 
 // E-step
 struct MachineCounts {
   vguard<vguard<double> > count;  // indexed: count[state][nTrans]
   MachineCounts();
   MachineCounts (const EvaluatedMachine&);
-  MachineCounts (const EvaluatedMachine&, const SeqPair&);
+  MachineCounts (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());
   void init (const EvaluatedMachine&);
-  double add (const EvaluatedMachine&, const SeqPair&);  // returns log-likelihood
+  double add (const EvaluatedMachine&, const SeqPair&, const DPOptions& = DPOptions());  // returns log-likelihood
   MachineCounts& operator+= (const MachineCounts&);
   void writeJson (ostream&) const;
   map<string,double> paramCounts (const Machine&, const ParamAssign&) const;  // expectation of d(logLike)/d(logParam)
@@ -25,7 +27,7 @@ struct MachineObjective {
   map<string,size_t> transformedParamIndex;
   ParamDefs constantDefs, paramTransformDefs, allDefs;
   WeightExpr objective;
-  vguard<WeightExpr> deriv;
+  WeightTape tape;  // objective, with transformedParam as the slots; the gradient is found by reverse-mode differentiation
   MachineObjective (const Machine&, const MachineCounts&, const Constraints&, const Params&);
   Params optimize (const Params& seed) const;
   string toString() const;
@@ -2,36 +2,196 @@
 #include "dpmatrix.h"
 #include "logger.h"
 
-DPMatrix::DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
+#define DefaultWavefrontTileSize 256
+
+DPOptions::DPOptions() :
+  threads (1),
+  tileSize (DefaultWavefrontTileSize),
+  bandWidth (0),
+  xDrop (0),
+  blockBytes (0),
+  singlePrecision (false),
+  scaled (false)
+{ }
+
+template<class Cell>
+DPMatrix<Cell>::DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options, const DPEnvelope& envelope, bool rolling) :
   machine (machine),
   seqPair (seqPair),
   input (machine.inputTokenizer.tokenize (seqPair.input.seq)),
   output (machine.outputTokenizer.tokenize (seqPair.output.seq)),
   inLen (input.size()),
   outLen (output.size()),
-  nStates (machine.nStates())
+  nStates (machine.nStates()),
+  options (options),
+  fullEnvelope (false),
+  growEnvelope (false),
+  storedBlock (0),
+  blockStorageOffset (0),
+  rolling (rolling),
+  rollingSlotSize (0)
 {
+  blockSize = inLen + 1;
+  rollingRow = inLen + 1;
+  Assert (!rolling || envelope.outBegin.size(), "Rolling matrix needs an envelope");
   LogThisAt(7,"Creating " << (inLen+1) << "*" << (outLen+1) << "*" << nStates << " matrix" << endl);
   LogThisAt(8,"Machine:" << endl << machine.toJsonString() << endl);
-  cellStorage.resize (nCells(), -numeric_limits<double>::infinity());
+  if (envelope.outBegin.size())
+    initEnvelope (envelope);
+  else if (options.xDrop > 0) {
+    // rows are allocated as the first Forward-type fill discovers them, starting from the start cell
+    env.outBegin = env.outEnd = vguard<OutputIndex> (inLen + 1, 0);
+    rowOffset = vguard<long> (inLen + 1, 0);
+    rowCapacity = vguard<OutputIndex> (inLen + 1, 0);
+    growEnvelope = true;
+    growRow (0, 0);
+  } else
+    initEnvelope (bandEnvelope());
 }
 
-void DPMatrix::writeJson (ostream& outs) const {
+// If options.blockBytes is set (and the envelope is not from X-drop), only the checkpoint rows (every blockSize'th row) and the rows of one block in between are stored.
+// As in TraceDPMatrix, the block size is chosen so that the checkpoints plus one block fit in the memory limit, if possible
+template<class Cell>
+void DPMatrix<Cell>::initEnvelope (const DPEnvelope& envelope) {
+  Assert ((InputIndex) envelope.outBegin.size() == inLen + 1 && (InputIndex) envelope.outEnd.size() == inLen + 1, "Envelope does not fit matrix");
+  env = envelope;
+  rowOffset.resize (inLen + 1);
+  size_t nCells = 0;
+  for (InputIndex inPos = 0; inPos <= inLen; ++inPos)
+    nCells += max (0L, env.outEnd[inPos] - env.outBegin[inPos]);
+  fullEnvelope = (nCells == (size_t) ((inLen + 1) * (outLen + 1)));
+  LogThisAt(7,"Envelope has " << nCells << " cells" << endl);
+  if (rolling) {
+    OutputIndex maxRowCells = 0;
+    for (InputIndex inPos = 0; inPos <= inLen; ++inPos)
+      maxRowCells = max (maxRowCells, env.outEnd[inPos] - env.outBegin[inPos]);
+    rollingSlotSize = maxRowCells * nStates;
+    cellStorage.resize (2 * rollingSlotSize, -numeric_limits<Cell>::infinity());
+    return;
+  }
+  if (options.blockBytes && !growEnvelope) {
+    const double rowBytes = max (1., nCells / (double) (inLen + 1)) * nStates * sizeof(Cell);
+    blockSize = max ((InputIndex) 2,
+		     min (inLen + 1,
+			  (InputIndex) calcBlockSize ((size_t) (options.blockBytes / rowBytes), inLen)));
+    LogThisAt(8,"Block size is " << blockSize << " rows, # of checkpoint rows is " << (1 + inLen / blockSize) << endl);
+  }
+  if (checkpointed()) {
+    size_t offset = 0, maxBlockCells = 0;
+    for (InputIndex blockStart = 0; blockStart <= inLen; blockStart += blockSize) {
+      offset = layoutRows (blockStart, blockStart + 1, offset);
+      size_t blockCells = 0;
+      for (InputIndex inPos = blockStart + 1; inPos < min (inLen + 1, blockStart + blockSize); ++inPos)
+	blockCells += max (0L, env.outEnd[inPos] - env.outBegin[inPos]);
+      maxBlockCells = max (maxBlockCells, blockCells);
+    }
+    blockStorageOffset = offset;
+    cellStorage.resize (offset + maxBlockCells * nStates, -numeric_limits<Cell>::infinity());
+  } else
+    cellStorage.resize (layoutRows (0, inLen + 1, 0), -numeric_limits<Cell>::infinity());
+}
+
+template<class Cell>
+size_t DPMatrix<Cell>::layoutRows (InputIndex rowBegin, InputIndex rowEnd, size_t offset) {
+  for (InputIndex inPos = rowBegin; inPos < rowEnd; ++inPos) {
+    rowOffset[inPos] = (long) offset - env.outBegin[inPos] * nStates;
+    offset += max (0L, env.outEnd[inPos] - env.outBegin[inPos]) * nStates;
+  }
+  return offset;
+}
+
+template<class Cell>
+void DPMatrix<Cell>::layoutBlock (InputIndex blockStart) {
+  const size_t end = layoutRows (blockStart + 1, min (inLen + 1, blockStart + blockSize), blockStorageOffset);
+  fill (cellStorage.begin() + blockStorageOffset, cellStorage.begin() + end, -numeric_limits<Cell>::infinity());
+  storedBlock = blockStart;
+}
+
+template<class Cell>
+void DPMatrix<Cell>::layoutRollingRow (InputIndex inPos) {
+  Assert (rolling && inPos == rollingRow - 1, "Rolling rows must be laid out in decreasing order");
+  const size_t offset = (inPos % 2) * rollingSlotSize;
+  rowOffset[inPos] = (long) offset - env.outBegin[inPos] * nStates;
+  fill (cellStorage.begin() + offset, cellStorage.begin() + offset + rollingSlotSize, -numeric_limits<Cell>::infinity());
+  rollingRow = inPos;
+}
+
+// Rows only grow rightwards, so when a row outgrows its allocation it is moved to the end of cellStorage with twice the capacity.
+// Offsets into cellStorage remain valid when it is reallocated
+template<class Cell>
+void DPMatrix<Cell>::growRow (InputIndex inPos, OutputIndex outPos) {
+  if (env.outEnd[inPos] == env.outBegin[inPos])
+    env.outBegin[inPos] = env.outEnd[inPos] = outPos;
+  const OutputIndex rowCells = outPos + 1 - env.outBegin[inPos];
+  if (rowCells > rowCapacity[inPos]) {
+    const size_t offset = cellStorage.size();
+    const OutputIndex capacity = max (rowCells, 2 * rowCapacity[inPos]);
+    cellStorage.resize (offset + capacity * nStates, -numeric_limits<Cell>::infinity());
+    const long oldBegin = rowOffset[inPos] + env.outBegin[inPos] * nStates;
+    copy (cellStorage.begin() + oldBegin, cellStorage.begin() + oldBegin + (env.outEnd[inPos] - env.outBegin[inPos]) * nStates, cellStorage.begin() + offset);
+    rowOffset[inPos] = (long) offset - env.outBegin[inPos] * nStates;
+    rowCapacity[inPos] = capacity;
+  }
+  env.outEnd[inPos] = outPos + 1;
+}
+
+template<class Cell>
+void DPMatrix<Cell>::compactRows() {
+  vguard<Cell> grown;
+  grown.swap (cellStorage);
+  const vguard<long> grownOffset (rowOffset);
+  initEnvelope (env);
+  for (InputIndex inPos = 0; inPos <= inLen; ++inPos)
+    for (OutputIndex outPos = env.outBegin[inPos]; outPos < env.outEnd[inPos]; ++outPos)
+      copy (grown.begin() + grownOffset[inPos] + outPos * nStates, grown.begin() + grownOffset[inPos] + (outPos + 1) * nStates, cellStorage.begin() + rowOffset[inPos] + outPos * nStates);
+  vguard<OutputIndex>().swap (rowCapacity);
+  growEnvelope = false;
+}
+
+// The band is centered on the line from (0,0) to (inLen,outLen).
+// Each row overlaps the previous one so that the start and end cells are always connected
+template<class Cell>
+DPEnvelope DPMatrix<Cell>::bandEnvelope() const {
+  DPEnvelope band;
+  band.outBegin.resize (inLen + 1);
+  band.outEnd.resize (inLen + 1);
+  const bool banded = options.bandWidth > 0 && inLen > 0;
+  for (InputIndex inPos = 0; inPos <= inLen; ++inPos) {
+    if (banded) {
+      const double center = inPos * (double) outLen / (double) inLen;
+      band.outBegin[inPos] = max (0L, (OutputIndex) floor (center - options.bandWidth));
+      band.outEnd[inPos] = min (outLen + 1, (OutputIndex) ceil (center + options.bandWidth) + 1);
+      if (inPos > 0) {
+	band.outBegin[inPos] = min (band.outBegin[inPos], band.outEnd[inPos-1]);
+	band.outEnd[inPos] = max (band.outEnd[inPos], band.outEnd[inPos-1]);
+      }
+    } else {
+      band.outBegin[inPos] = 0;
+      band.outEnd[inPos] = outLen + 1;
+    }
+  }
+  band.outBegin[0] = 0;
+  band.outEnd[inLen] = outLen + 1;
+  return band;
+}
+
+template<class Cell>
+void DPMatrix<Cell>::writeJson (ostream& outs) const {
   outs << "{" << endl
        << " \"input\": \"" << seqPair.input.name << "\"," << endl
        << " \"output\": \"" << seqPair.output.name << "\"," << endl
        << " \"cell\": [";
+  bool first = true;
   for (InputIndex i = 0; i <= inLen; ++i)
-    for (OutputIndex o = 0; o <= outLen; ++o)
-      for (StateIndex s = 0; s < nStates; ++s)
-	outs << ((i || o || s) ? "," : "") << endl
-	     << "  { \"inPos\": " << i << ", \"outPos\": " << o << ", \"state\": " << machine.state[s].name << ", \"logLike\": " << setprecision(5) << cell(i,o,s) << " }";
+    if (rowStored (i))
+      for (OutputIndex o = 0; o <= outLen; ++o)
+	for (StateIndex s = 0; s < nStates; ++s, first = false)
+	  outs << (first ? "" : ",") << endl
+	       << "  { \"inPos\": " << i << ", \"outPos\": " << o << ", \"state\": " << machine.state[s].name << ", \"logLike\": " << setprecision(5) << cell(i,o,s) << " }";
   outs << endl
        << " ]" << endl
        << "}" << endl;
 }
 
-ostream& operator<< (ostream& out, const DPMatrix& m) {
-  m.writeJson (out);
-  return out;
-}
+template class DPMatrix<float>;
+template class DPMatrix<double>;
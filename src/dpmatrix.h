@@ -1,47 +1,309 @@
 #ifndef DPMATRIX_INCLUDED
 #define DPMATRIX_INCLUDED
 
+#include <atomic>
+#include <memory>
 #include "eval.h"
 #include "seqpair.h"
 #include "logsumexp.h"
+#include "workers.h"
 
+// Options controlling how a DPMatrix is filled
+struct DPOptions {
+  size_t threads;  // if >1, fill tiles of the matrix on the same anti-diagonal concurrently
+  long tileSize;  // width & height of a wavefront tile, in sequence positions
+  long bandWidth;  // if >0, only fill cells within this many output positions of the main diagonal
+  double xDrop;  // if >0, only fill cells reachable from cells scoring within xDrop of the best cell in their column
+  size_t blockBytes;  // if >0, approximate memory limit: only checkpoint rows and one block of rows are kept, the rest being recomputed on demand (not used with xDrop)
+  bool singlePrecision;  // if true, callers that choose the cell type use DPMatrix<float>
+  bool scaled;  // if true, Forward-Backward counts are computed in probability space (see ScaledDPMatrix), falling back to log space on underflow
+  DPOptions();
+};
+
+// The cells of a DPMatrix that are actually stored: for each input position inPos, the output positions outBegin[inPos]..outEnd[inPos]-1
+struct DPEnvelope {
+  vguard<long> outBegin, outEnd;
+};
+
+// Log-space semirings for the DP recursions, passed to DPMatrix fills as template parameters so the reduction is inlined.
+// Cells start at -infinity (the semiring zero); one() is the multiplicative identity.
+// reduce(x,n) reduces a gathered batch of n terms.
+struct SumProductSemiring {
+  static inline double one() { return 0; }
+  static inline double reduce (double x, double y) { return log_sum_exp(x,y); }
+  static inline double reduce (const double* x, size_t n) { return log_sum_exp(x,n); }
+};
+
+struct MaxProductSemiring {
+  static inline double one() { return 0; }
+  static inline double reduce (double x, double y) { return max(x,y); }
+  static inline double reduce (const double* x, size_t n) { return *max_element(x,x+n); }
+};
+
+// Cells are stored as Cell (float or double), but the recursions are evaluated in double, and only rounded to Cell when a cell is stored.
+// With float cells the matrix takes half the memory, and absolute log-likelihoods lose precision in proportion to their magnitude
+template<class Cell>
 class DPMatrix {
 public:
   typedef long InputIndex;
   typedef long OutputIndex;
 
 private:
-  typedef long long CellIndex;
+  // Cell (inPos,outPos,state) is cellStorage[rowOffset[inPos] + outPos*nStates + state]
+  vguard<Cell> cellStorage;
+  vguard<long> rowOffset;
+  DPEnvelope env;
+  bool fullEnvelope;  // true if every cell is in the envelope
+  bool growEnvelope;  // true until the X-drop envelope has been determined by the first Forward-type fill
+  vguard<OutputIndex> rowCapacity;  // while growing the X-drop envelope, the number of cells allocated for each row
+  InputIndex blockSize;  // rows per checkpointed block; inLen+1 if every row is stored
+  InputIndex storedBlock;  // if checkpointed, the first row of the block whose rows are currently stored
+  size_t blockStorageOffset;  // if checkpointed, the offset in cellStorage of the rows between checkpoints
+  bool rolling;  // if true, only two rows are stored, in alternating slots, for Backward-type fills that are consumed row by row
+  InputIndex rollingRow;  // if rolling, the lower of the two stored rows
+  size_t rollingSlotSize;  // if rolling, the size of each row slot in cellStorage
+  mutable unique_ptr<WorkerPool> pool;  // helper threads for tiled fills, started by the first one and kept until the matrix is destroyed
 
-  vguard<double> cellStorage;
+  void initEnvelope (const DPEnvelope& envelope);
+  size_t layoutRows (InputIndex rowBegin, InputIndex rowEnd, size_t offset);  // places rows contiguously from offset, returning the offset after them
+  void layoutBlock (InputIndex blockStart);  // places the rows after checkpoint blockStart in the shared block storage
+  void growRow (InputIndex inPos, OutputIndex outPos);  // while growing the X-drop envelope, extends row inPos to include outPos
+  void compactRows();  // once the X-drop envelope is complete, moves the rows into contiguous storage
+  DPEnvelope bandEnvelope() const;
 
-  inline CellIndex nCells() const {
-    return nStates * (inLen + 1) * (outLen + 1);
+  // Forward-type X-drop sweep, in column-major order.
+  // Cells in the same column have emitted the same output prefix, so their log-likelihoods are comparable
+  // (cells on an anti-diagonal are not, since the input is conditioned on rather than emitted).
+  // Each column visits the cells reachable from the surviving cells of the previous column,
+  // continuing down while the last cell is within xDrop of the best so far; once the column is complete,
+  // cells more than xDrop below its best are dropped.
+  // Each row's stored cells remain contiguous: if a row drops out and re-enters, the skipped cells are left at -infinity
+  template<class CellVisitor>
+  void forEachCellXDrop (CellVisitor visitCell) {
+    const double minusInf = -numeric_limits<double>::infinity();
+    const DPEnvelope band = bandEnvelope();
+    InputIndex liveBegin = 0, liveEnd = 1;  // surviving input positions in the previous column
+    vguard<double> cellMax (inLen + 1);
+    for (OutputIndex outPos = 0; outPos <= outLen && liveBegin < liveEnd; ++outPos) {
+      const InputIndex reachEnd = outPos ? min (inLen + 1, liveEnd + 1) : 1;
+      double colBest = minusInf;
+      InputIndex inPos;
+      for (inPos = liveBegin; inPos < reachEnd || (inPos <= inLen && cellMax[inPos-1] > minusInf && cellMax[inPos-1] >= colBest - options.xDrop); ++inPos) {
+	cellMax[inPos] = minusInf;
+	if (outPos < band.outBegin[inPos] || outPos >= band.outEnd[inPos])
+	  continue;
+	if (outPos >= env.outEnd[inPos])
+	  growRow (inPos, outPos);
+	visitCell (inPos, outPos);
+	const Cell* c = cellStorage.data() + rowOffset[inPos] + outPos * nStates;
+	colBest = max (colBest, cellMax[inPos] = *max_element (c, c + nStates));
+      }
+      const InputIndex colEnd = inPos;
+      for (inPos = liveBegin, liveEnd = liveBegin; inPos < colEnd; ++inPos)
+	if (cellMax[inPos] > minusInf && cellMax[inPos] >= colBest - options.xDrop) {
+	  if (liveEnd == liveBegin)
+	    liveBegin = inPos;
+	  liveEnd = inPos + 1;
+	}
+    }
+    compactRows();
   }
 
-  inline CellIndex cellIndex (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
-    return (inPos * (outLen + 1) + outPos) * nStates + state;
+protected:
+  // Calls visitCell(inPos,outPos) for every stored cell in rows rowBegin..rowEnd-1, visiting each cell after its predecessors (or, if reverse is true, after its successors).
+  // Serially this is a row-major sweep. Unless serial is true, with options.threads > 1 the matrix is cut into square tiles, and the tiles on each
+  // anti-diagonal, which depend only on tiles from earlier anti-diagonals, are filled concurrently by the matrix's worker pool.
+  // Each cell sees the same sequence of operations either way, so the results are identical.
+  template<class CellVisitor>
+  void forEachCell (InputIndex rowBegin, InputIndex rowEnd, bool reverse, bool serial, CellVisitor visitCell) const {
+    Assert (!growEnvelope, "X-drop envelope must be determined by a Forward-type fill");
+    const long tileSize = max (1L, options.tileSize);
+    const long nInTiles = (rowEnd - rowBegin - 1) / tileSize + 1, nOutTiles = outLen / tileSize + 1;
+    auto visitTile = [&] (long inTile, long outTile) {
+      const InputIndex inBegin = rowBegin + inTile * tileSize, inEnd = min (rowEnd, inBegin + tileSize);
+      const OutputIndex outBegin = outTile * tileSize, outEnd = min (outLen + 1, outBegin + tileSize);
+      if (reverse) {
+	for (InputIndex inPos = inEnd - 1; inPos >= inBegin; --inPos)
+	  for (OutputIndex outPos = min (outEnd, env.outEnd[inPos]) - 1; outPos >= max (outBegin, env.outBegin[inPos]); --outPos)
+	    visitCell (inPos, outPos);
+      } else {
+	for (InputIndex inPos = inBegin; inPos < inEnd; ++inPos)
+	  for (OutputIndex outPos = max (outBegin, env.outBegin[inPos]); outPos < min (outEnd, env.outEnd[inPos]); ++outPos)
+	    visitCell (inPos, outPos);
+      }
+    };
+    if (serial || options.threads <= 1 || nInTiles + nOutTiles < 3) {
+      if (reverse) {
+	for (InputIndex inPos = rowEnd - 1; inPos >= rowBegin; --inPos)
+	  for (OutputIndex outPos = env.outEnd[inPos] - 1; outPos >= env.outBegin[inPos]; --outPos)
+	    visitCell (inPos, outPos);
+      } else {
+	for (InputIndex inPos = rowBegin; inPos < rowEnd; ++inPos)
+	  for (OutputIndex outPos = env.outBegin[inPos]; outPos < env.outEnd[inPos]; ++outPos)
+	    visitCell (inPos, outPos);
+      }
+      return;
+    }
+    if (!pool)
+      pool.reset (new WorkerPool (options.threads, "DP"));
+    const long nDiagonals = nInTiles + nOutTiles - 1;
+    for (long k = 0; k < nDiagonals; ++k) {
+      const long diag = reverse ? (nDiagonals - 1 - k) : k;
+      const long inTileBegin = max (0L, diag - nOutTiles + 1), inTileEnd = min (nInTiles, diag + 1);
+      atomic<long> nextInTile (inTileBegin);
+      pool->run (min (pool->size(), (size_t) (inTileEnd - inTileBegin)), [&] (size_t) {
+	  for (long inTile; (inTile = nextInTile++) < inTileEnd; )
+	    visitTile (inTile, diag - inTile);
+	});
+    }
   }
 
-protected:
-  inline void accumulate (double& ll, const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, function<double(double,double)> reduce) const {
-    auto visit = [&] (StateIndex, EvaluatedMachineState::TransIndex, double t) { ll = reduce(ll,t); };
-    iterate (inOutStateTransMap, inTok, outTok, inPos, outPos, visit);
+  // Generic Backward-type sweep, in Backward fill order.
+  // For every transition of the class emitted from cell (inPos,outPos), calls visit(trans,destCell,inPos,outPos), where destCell (a const Cell*) points to the destination cell's per-state values.
+  // Classes whose destination cell is outside the envelope are skipped.
+  // Visitors that write anywhere other than cell (inPos,outPos) must request a serial sweep
+  template<class Visitor>
+  void sweepOutgoing (InputIndex rowBegin, InputIndex rowEnd, Visitor visit, bool serial = false) const {
+    forEachCell (rowBegin, rowEnd, true, serial, [&] (InputIndex inPos, OutputIndex outPos) {
+	const bool endOfInput = (inPos == inLen);
+	const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+	const bool endOfOutput = (outPos == outLen);
+	const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+	if (!endOfInput && !endOfOutput)
+	  visitClass (machine.outgoing, visit, inTok, outTok, inPos + 1, outPos + 1, inPos, outPos);
+	if (!endOfInput)
+	  visitClass (machine.outgoing, visit, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos, inPos, outPos);
+	if (!endOfOutput)
+	  visitClass (machine.outgoing, visit, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1, inPos, outPos);
+	visitClass (machine.outgoing, visit, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, inPos, outPos);
+      });
   }
 
-  inline void iterate (const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, function<void(StateIndex,EvaluatedMachineState::TransIndex,double)> visit) const {
-    if (inOutStateTransMap.count (inTok)) {
-      const EvaluatedMachineState::OutStateTransMap& outStateTransMap = inOutStateTransMap.at (inTok);
-      if (outStateTransMap.count (outTok))
-	for (const auto& st: outStateTransMap.at (outTok)) {
-	  const EvaluatedMachineState::Trans& trans = st.second;
-	  visit (st.first, trans.transIndex, cell(inPos,outPos,st.first) + trans.logWeight);
+  // a class whose other cell is outside the envelope is skipped, since its transitions would all contribute -infinity
+  template<class Visitor>
+  inline void visitClass (const EvaluatedTransTable& table, Visitor& visit, InputToken inTok, OutputToken outTok, InputIndex otherInPos, OutputIndex otherOutPos, InputIndex inPos, OutputIndex outPos) const {
+    if (!fullEnvelope && !inEnvelope (otherInPos, otherOutPos))
+      return;
+    const Cell* otherCell = cellStorage.data() + rowOffset[otherInPos] + otherOutPos * nStates;
+    for (auto iter = table.begin (inTok, outTok), end = table.end (inTok, outTok); iter != end; ++iter)
+      visit (*iter, otherCell, inPos, outPos);
+  }
+
+  // write access to a stored cell, for use by fills
+  inline Cell& cellRef (InputIndex inPos, OutputIndex outPos, StateIndex state) {
+    return cellStorage[rowOffset[inPos] + outPos * nStates + state];
+  }
+
+  // Fill kernel for the transitions of one class into (Forward) or out of (Backward) the cell at cellOffset.
+  // The class is sorted by the state being filled, so its transitions come in runs that share that state.
+  // Short runs are reduced term by term; longer ones are gathered into a buffer that the semiring reduces as a batch.
+  // Each run is reduced in double, and stored once
+  template<class Semiring, bool Forward>
+  inline void reduceClass (long cellOffset, const EvaluatedTransTable& table, InputToken inTok, OutputToken outTok, InputIndex otherInPos, OutputIndex otherOutPos) {
+    if (!fullEnvelope && !inEnvelope (otherInPos, otherOutPos))
+      return;
+    Cell* cell = cellStorage.data() + cellOffset;
+    const Cell* otherCell = cellStorage.data() + rowOffset[otherInPos] + otherOutPos * nStates;
+    for (auto iter = table.begin (inTok, outTok), end = table.end (inTok, outTok); iter != end; ) {
+      const StateIndex state = Forward ? iter->dest : iter->src;
+      auto runEnd = iter + 1;
+      while (runEnd != end && (Forward ? runEnd->dest : runEnd->src) == state)
+	++runEnd;
+      double ll = cell[state];
+      if (runEnd - iter < LOG_SUM_EXP_BATCH_MIN)
+	for (; iter != runEnd; ++iter)
+	  ll = Semiring::reduce (ll, otherCell[Forward ? iter->src : iter->dest] + iter->logWeight);
+      else {
+	double batch[LOG_SUM_EXP_BATCH_SIZE];
+	while (iter != runEnd) {
+	  size_t n = 0;
+	  for (; iter != runEnd && n < LOG_SUM_EXP_BATCH_SIZE; ++iter)
+	    batch[n++] = otherCell[Forward ? iter->src : iter->dest] + iter->logWeight;
+	  ll = Semiring::reduce (ll, Semiring::reduce (batch, n));
 	}
+      }
+      cell[state] = ll;
+    }
+  }
+
+  // Silent transitions go from lower to higher states, and come last, so they read finished values
+  template<class Semiring>
+  void fillIncomingRows (InputIndex rowBegin, InputIndex rowEnd) {
+    auto fillCell = [this] (InputIndex inPos, OutputIndex outPos) {
+      const long offset = rowOffset[inPos] + outPos * nStates;
+      const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
+      const OutputToken outTok = outPos ? output[outPos-1] : OutputTokenizer::emptyToken();
+      if (inPos && outPos)
+	reduceClass<Semiring,true> (offset, machine.incoming, inTok, outTok, inPos - 1, outPos - 1);
+      if (inPos)
+	reduceClass<Semiring,true> (offset, machine.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
+      if (outPos)
+	reduceClass<Semiring,true> (offset, machine.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
+      reduceClass<Semiring,true> (offset, machine.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+    };
+    if (growEnvelope)
+      forEachCellXDrop (fillCell);
+    else
+      forEachCell (rowBegin, rowEnd, false, false, fillCell);
+  }
+
+  // Forward-type fill: cell(inPos,outPos,dest) = reduce over incoming transitions of cell(srcInPos,srcOutPos,src)+weight
+  // If checkpointed, the fill proceeds one block at a time, and afterwards only the checkpoint rows and the last block are stored
+  template<class Semiring>
+  void fillIncoming() {
+    if (inEnvelope (0, 0))
+      cellRef (0, 0, machine.startState()) = Semiring::one();
+    if (!checkpointed()) {
+      fillIncomingRows<Semiring> (0, inLen + 1);
+      return;
+    }
+    for (InputIndex blockStart = 0; blockStart <= inLen; blockStart += blockSize) {
+      fillIncomingRows<Semiring> (blockStart, blockStart + 1);  // the checkpoint row depends on the last row of the previous block, which is about to be overwritten
+      layoutBlock (blockStart);
+      fillIncomingRows<Semiring> (blockStart + 1, min (inLen + 1, blockStart + blockSize));
     }
   }
 
-  static inline double sum_reduce (double x, double y) { return log_sum_exp(x,y); }
-  static inline double max_reduce (double x, double y) { return max(x,y); }
+  // Ensures that row inPos of a checkpointed Forward-type matrix is stored, refilling its block from the preceding checkpoint if necessary.
+  // This overwrites the previously stored block, so callers should visit rows in decreasing order, as a traceback does
+  template<class Semiring>
+  void readyRow (InputIndex inPos) {
+    const InputIndex blockStart = checkpoint (inPos);
+    if (blockStart == storedBlock || blockStart == inPos)
+      return;
+    layoutBlock (blockStart);
+    fillIncomingRows<Semiring> (blockStart + 1, min (inLen + 1, blockStart + blockSize));
+  }
+
+  // places row inPos of a rolling matrix in the slot not occupied by row inPos+1, so rows must be laid out in decreasing order
+  void layoutRollingRow (InputIndex inPos);
+
+  template<class Semiring>
+  void fillOutgoingRows (InputIndex rowBegin, InputIndex rowEnd) {
+    if (inEnvelope (inLen, outLen) && rowEnd > inLen)
+      cellRef (inLen, outLen, machine.endState()) = Semiring::one();
+    forEachCell (rowBegin, rowEnd, true, false, [this] (InputIndex inPos, OutputIndex outPos) {
+	const long offset = rowOffset[inPos] + outPos * nStates;
+	const bool endOfInput = (inPos == inLen);
+	const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+	const bool endOfOutput = (outPos == outLen);
+	const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+	if (!endOfInput && !endOfOutput)
+	  reduceClass<Semiring,false> (offset, machine.outgoing, inTok, outTok, inPos + 1, outPos + 1);
+	if (!endOfInput)
+	  reduceClass<Semiring,false> (offset, machine.outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
+	if (!endOfOutput)
+	  reduceClass<Semiring,false> (offset, machine.outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
+	reduceClass<Semiring,false> (offset, machine.outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+      });
+  }
+
+  // Backward-type fill: cell(inPos,outPos,src) = reduce over outgoing transitions of cell(destInPos,destOutPos,dest)+weight
+  template<class Semiring>
+  void fillOutgoing() {
+    Assert (!checkpointed() && !rolling, "Backward-type fills are not checkpointed");
+    fillOutgoingRows<Semiring> (0, inLen + 1);
+  }
 
 public:
   const EvaluatedMachine& machine;
@@ -51,14 +313,41 @@ public:
   const InputIndex inLen;
   const OutputIndex outLen;
   const StateIndex nStates;
+  const DPOptions options;
 
-  DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair);
+  // if envelope is empty, the stored cells are determined by options.bandWidth and options.xDrop.
+  // if rolling is true, only two rows are stored at any time (see layoutRollingRow); this requires an envelope
+  DPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options, const DPEnvelope& envelope = DPEnvelope(), bool rolling = false);
 
   void writeJson (ostream& out) const;
-  friend ostream& operator<< (ostream&, const DPMatrix&);
-  
-  inline double& cell (InputIndex inPos, OutputIndex outPos, StateIndex state) { return cellStorage[cellIndex(inPos,outPos,state)]; }
-  inline const double cell (InputIndex inPos, OutputIndex outPos, StateIndex state) const { return cellStorage[cellIndex(inPos,outPos,state)]; }
+
+  inline const DPEnvelope& envelope() const { return env; }
+  inline bool checkpointed() const { return blockSize <= inLen; }
+  inline InputIndex checkpoint (InputIndex inPos) const { return inPos - (inPos % blockSize); }
+  inline bool rowStored (InputIndex inPos) const {
+    if (rolling)
+      return inPos == rollingRow || inPos == rollingRow + 1;
+    return !checkpointed() || checkpoint (inPos) == inPos || checkpoint (inPos) == storedBlock;
+  }
+  inline bool inEnvelope (InputIndex inPos, OutputIndex outPos) const {
+    return outPos >= env.outBegin[inPos] && outPos < env.outEnd[inPos];
+  }
+
+  // cells outside the envelope have log-likelihood -infinity; a checkpointed or rolling matrix must only be read at stored rows
+  inline double cell (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
+    return inEnvelope (inPos, outPos) ? storedCell (inPos, outPos, state) : -numeric_limits<double>::infinity();
+  }
+
+  // unchecked read access, for cells known to be in the envelope
+  inline double storedCell (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
+    return cellStorage[rowOffset[inPos] + outPos * nStates + state];
+  }
 };
 
+template<class Cell>
+ostream& operator<< (ostream& out, const DPMatrix<Cell>& m) {
+  m.writeJson (out);
+  return out;
+}
+
 #endif /* DPMATRIX_INCLUDED */
@@ -9,31 +9,106 @@ void EvaluatedMachineState::Trans::init (LogWeight lw, TransIndex ti) {
 }
 
 EvaluatedMachine::EvaluatedMachine (const Machine& machine, const Params& params) :
+  EvaluatedMachine (machine, compileWeights (machine, params.defs), params.defs)
+{ }
+
+WeightTape EvaluatedMachine::compileWeights (const Machine& machine, const ParamDefs& defs) {
+  ProgressLog(plog,6);
+  plog.initProgress ("Compiling transition weights");
+  WeightTape tape (defs);
+  for (StateIndex s = 0; s < machine.nStates(); ++s) {
+    plog.logProgress (s / (double) machine.nStates(), "state %lu/%lu", s, machine.nStates());
+    for (const auto& trans: machine.state[s].trans)
+      tape.compile (trans.weight);
+  }
+  LogThisAt(7,"Compiled " << tape.result.size() << " transition weights into " << tape.instr.size() << " tape instructions" << endl);
+  return tape;
+}
+
+EvaluatedMachine::EvaluatedMachine (const Machine& machine, const WeightTape& tape, const ParamDefs& defs) :
   inputTokenizer (machine.inputAlphabet()),
   outputTokenizer (machine.outputAlphabet()),
   state (machine.nStates())
 {
   Assert (machine.isAdvancingMachine(), "Machine is not topologically sorted");
   Assert (machine.isAligningMachine(), "Machine has ambiguous transitions");
+  Assert (tape.result.size() == machine.nTransitions(), "Tape has %lu transition weights, but machine has %lu transitions", tape.result.size(), machine.nTransitions());
 
-  ProgressLog(plog,6);
-  plog.initProgress ("Evaluating transition weights");
+  vguard<double> paramValue;
+  if (!tape.slotValues (defs, paramValue))
+    Abort ("Parameters differ from those the transition weights were compiled with");
+  vguard<double> reg;
+  tape.eval (paramValue, reg);
 
+  vguard<pair<size_t,EvaluatedTrans> > classTrans;
+  size_t n = 0;
   for (StateIndex s = 0; s < nStates(); ++s) {
-    plog.logProgress (s / (double) nStates(), "state %lu/%lu", s, nStates());
     state[s].name = machine.state[s].name;
     EvaluatedMachineState::TransIndex ti = 0;
     for (const auto& trans: machine.state[s].trans) {
       const StateIndex d = trans.dest;
-      const InputToken in = inputTokenizer.sym2tok.at (trans.in);
-      const OutputToken out = outputTokenizer.sym2tok.at (trans.out);
-      const LogWeight lw = log (WeightAlgebra::eval (trans.weight, params.defs));
-      state[s].outgoing[in][out][d].init (lw, ti);
-      state[d].incoming[in][out][s].init (lw, ti);
-      ++ti;
+      const InputToken in = inputTokenizer.token (trans.in);
+      const OutputToken out = outputTokenizer.token (trans.out);
+      addTrans (classTrans, s, in, out, d, log (tape.value (reg, n++)), ti++);
+    }
+    state[s].nTransitions = ti;
+  }
+
+  buildTransTables (classTrans);
+}
+
+EvaluatedMachine::EvaluatedMachine (const vguard<InputSymbol>& inputAlphabet, const vguard<OutputSymbol>& outputAlphabet, const vguard<StateName>& stateName, const vguard<vguard<TokenTrans> >& trans) :
+  inputTokenizer (inputAlphabet),
+  outputTokenizer (outputAlphabet),
+  state (trans.size())
+{
+  Assert (stateName.size() == trans.size(), "Number of states mismatch");
+  vguard<pair<size_t,EvaluatedTrans> > classTrans;
+  for (StateIndex s = 0; s < nStates(); ++s) {
+    state[s].name = stateName[s];
+    EvaluatedMachineState::TransIndex ti = 0;
+    for (const auto& t: trans[s]) {
+      Assert (t.in || t.out || t.dest > s || (t.dest == s && s == startState()), "Machine is not topologically sorted");
+      addTrans (classTrans, s, t.in, t.out, t.dest, t.logWeight, ti++);
     }
     state[s].nTransitions = ti;
   }
+
+  buildTransTables (classTrans);
+}
+
+void EvaluatedMachine::addTrans (vguard<pair<size_t,EvaluatedTrans> >& classTrans, StateIndex s, InputToken in, OutputToken out, StateIndex d, LogWeight lw, EvaluatedMachineState::TransIndex ti) {
+  state[s].outgoing[in][out][d].init (lw, ti);
+  state[d].incoming[in][out][s].init (lw, ti);
+  // a silent self-loop (only permitted on the start state) never contributes to the DP recursions, so leave it out of the flat tables
+  if (in || out || d > s)
+    classTrans.push_back (pair<size_t,EvaluatedTrans> (in * (size_t) outputTokenizer.tok2sym.size() + out, EvaluatedTrans { s, d, lw, ti }));
+}
+
+void EvaluatedMachine::buildTransTables (const vguard<pair<size_t,EvaluatedTrans> >& classTrans) {
+  const size_t nClasses = inputTokenizer.tok2sym.size() * outputTokenizer.tok2sym.size();
+  vguard<size_t> classOffset (nClasses + 1, 0);
+  for (const auto& ct: classTrans)
+    ++classOffset[ct.first + 1];
+  for (size_t c = 0; c < nClasses; ++c)
+    classOffset[c+1] += classOffset[c];
+
+  incoming.nOutToks = outgoing.nOutToks = outputTokenizer.tok2sym.size();
+  incoming.classOffset = outgoing.classOffset = classOffset;
+  incoming.trans.resize (classTrans.size());
+  outgoing.trans.resize (classTrans.size());
+
+  vguard<size_t> next (classOffset.begin(), classOffset.end() - 1);
+  for (const auto& ct: classTrans)
+    incoming.trans[next[ct.first]++] = ct.second;
+  outgoing.trans = incoming.trans;
+
+  for (size_t c = 0; c < nClasses; ++c) {
+    sort (incoming.trans.begin() + classOffset[c], incoming.trans.begin() + classOffset[c+1],
+	  [] (const EvaluatedTrans& a, const EvaluatedTrans& b) { return a.dest == b.dest ? a.src < b.src : a.dest < b.dest; });
+    sort (outgoing.trans.begin() + classOffset[c], outgoing.trans.begin() + classOffset[c+1],
+	  [] (const EvaluatedTrans& a, const EvaluatedTrans& b) { return a.src == b.src ? a.dest < b.dest : a.src > b.src; });
+  }
 }
 
 StateIndex EvaluatedMachine::nStates() const {
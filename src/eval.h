@@ -4,18 +4,31 @@
 #include <algorithm>
 #include "machine.h"
 #include "params.h"
+#include "tape.h"
 
 template<typename Symbol,typename Token>
 struct Tokenizer {
   vguard<Symbol> tok2sym;
   map<Symbol,Token> sym2tok;
+  vguard<Token> symId2tok;  // token of each interned transition label, by SymbolId; -1 if not in this alphabet
   Tokenizer (const vguard<Symbol>& symbols) {
     tok2sym.push_back (string());   // token zero is the empty string
     tok2sym.insert (tok2sym.end(), symbols.begin(), symbols.end());
-    for (Token tok = 0; tok < (Token) tok2sym.size(); ++tok)
+    for (Token tok = 0; tok < (Token) tok2sym.size(); ++tok) {
       sym2tok[tok2sym[tok]] = tok;
+      const SymbolId id = MachineSymbol (tok2sym[tok]).id();
+      if (id >= symId2tok.size())
+	symId2tok.resize (id + 1, -1);
+      symId2tok[id] = tok;
+    }
   }
   static inline Token emptyToken() { return 0; }
+  // token of a transition label, without a string lookup
+  inline Token token (const MachineSymbol& sym) const {
+    const Token tok = sym.id() < symId2tok.size() ? symId2tok[sym.id()] : -1;
+    Assert (tok >= 0, "Symbol %s is not in the alphabet", sym.c_str());
+    return tok;
+  }
   vguard<Token> tokenize (const vguard<Symbol>& symSeq) const {
     vguard<Token> tokSeq;
     tokSeq.reserve (symSeq.size());
@@ -49,17 +62,59 @@ struct EvaluatedMachineState {
   InOutStateTransMap incoming, outgoing;  // indexed by input token, output token, and (source or destination) state
 };
 
+struct EvaluatedTrans {
+  StateIndex src, dest;
+  LogWeight logWeight;
+  EvaluatedMachineState::TransIndex transIndex;
+};
+
+// Flat transition index used by the DP inner loops.
+// Transitions are stored contiguously, grouped by (input token, output token) class,
+// so that each class can be iterated linearly without any map lookups.
+struct EvaluatedTransTable {
+  typedef vguard<EvaluatedTrans>::const_iterator const_iterator;
+  OutputToken nOutToks;
+  vguard<EvaluatedTrans> trans;
+  vguard<size_t> classOffset;  // transitions of class (inTok,outTok) are trans[classOffset[c]]..trans[classOffset[c+1]-1], where c = inTok*nOutToks + outTok
+  inline const_iterator begin (InputToken inTok, OutputToken outTok) const {
+    return trans.begin() + classOffset[inTok * nOutToks + outTok];
+  }
+  inline const_iterator end (InputToken inTok, OutputToken outTok) const {
+    return trans.begin() + classOffset[inTok * nOutToks + outTok + 1];
+  }
+};
+
 struct EvaluatedMachine {
+  // an already-evaluated transition, for building an EvaluatedMachine without a Machine.
+  // Tokens are those assigned by Tokenizer's of the alphabets passed to that constructor
+  struct TokenTrans {
+    InputToken in;
+    OutputToken out;
+    StateIndex dest;
+    LogWeight logWeight;
+  };
+
   InputTokenizer inputTokenizer;
   OutputTokenizer outputTokenizer;
   vguard<EvaluatedMachineState> state;
+  EvaluatedTransTable incoming;  // within each class, sorted by destination then source (the Forward/Viterbi fill order)
+  EvaluatedTransTable outgoing;  // within each class, sorted by descending source then destination (the Backward fill order)
   EvaluatedMachine (const Machine&, const Params&);
+  // weightTape must have been compiled by compileWeights from this machine, and defs must have the slots and definitions it was compiled with
+  // (so a tape can be compiled once, and reused while only the parameter values change)
+  EvaluatedMachine (const Machine&, const WeightTape& weightTape, const ParamDefs& defs);
+  EvaluatedMachine (const vguard<InputSymbol>& inputAlphabet, const vguard<OutputSymbol>& outputAlphabet, const vguard<StateName>& stateName, const vguard<vguard<TokenTrans> >& trans);  // trans[s] is state s's transitions, in TransIndex order
   void writeJson (ostream&) const;
   string toJsonString() const;
   StateIndex nStates() const;
   StateIndex startState() const;
   StateIndex endState() const;
   string stateNameJson (StateIndex) const;
+  // compiles the transition weights, in state and TransIndex order, into one tape whose slots are the numeric parameters of defs
+  static WeightTape compileWeights (const Machine&, const ParamDefs& defs);
+private:
+  void addTrans (vguard<pair<size_t,EvaluatedTrans> >& classTrans, StateIndex src, InputToken in, OutputToken out, StateIndex dest, LogWeight lw, EvaluatedMachineState::TransIndex ti);
+  void buildTransTables (const vguard<pair<size_t,EvaluatedTrans> >&);
 };
 
 #endif /* EVAL_INCLUDED */
@@ -0,0 +1,281 @@
+#include <queue>
+#include <deque>
+#include <tuple>
+#include <unordered_map>
+#include "factored.h"
+#include "logger.h"
+
+const FactoredComposition::ComponentTransIndex FactoredComposition::NoTrans;
+
+// Silent transitions in the product move first or second forward, or are a (non-silent) transition of first matched by a silent one of second,
+// so if both components are advancing machines, only the last kind can go backwards; those are sorted out when the product states are
+FactoredComposition::FactoredComposition (const Machine& origFirst, const Machine& origSecond) :
+  advancing (false),
+  first (origFirst.advancingMachine()),
+  second (origSecond.advancingMachine().waitingMachine()),
+  inputAlphabet (first.inputAlphabet()),
+  outputAlphabet (second.outputAlphabet())
+{
+  LogThisAt(3,"Composing " << first.nStates() << "-state transducer with " << second.nStates() << "-state transducer, keeping transitions factored" << endl);
+  Assert (second.isWaitingMachine(), "Attempt to compose transducers A*B where B is not a waiting machine");
+  const InputTokenizer inputTokenizer (inputAlphabet);
+  const OutputTokenizer outputTokenizer (outputAlphabet);
+
+  vguard<ComponentTransIndex> firstOffset (first.nStates()), secondOffset (second.nStates());
+  auto indexComponent = [&] (const Machine& m, StateIndex stateOffset, vguard<ComponentTransIndex>& offset) {
+    for (StateIndex s = 0; s < m.nStates(); ++s) {
+      offset[s] = componentWeight.size();
+      size_t t = 0;
+      for (const auto& trans: m.state[s].trans) {
+	componentWeight.push_back (trans.weight);
+	componentTransPos.push_back (pair<StateIndex,size_t> (stateOffset + s, t++));
+      }
+    }
+  };
+  indexComponent (first, 0, firstOffset);
+  indexComponent (second, first.nStates(), secondOffset);
+  // second's transitions by input symbol, for matching first's outputs
+  const MachineInputIndex secondIndex (second);
+  unordered_map<const MachineTransition*,ComponentTransIndex> secondTransIndex;
+  for (StateIndex j = 0; j < second.nStates(); ++j) {
+    ComponentTransIndex secondTrans = secondOffset[j];
+    for (const auto& jt: second.state[j].trans)
+      secondTransIndex[&jt] = secondTrans++;
+  }
+
+  // depth-first search of the accessible product states, expanding each on first visit
+  const StateIndex jStates = second.nStates();
+  unordered_map<StateIndex,StateIndex> expanded;  // i*jStates+j => search index
+  vguard<pair<StateIndex,StateIndex> > searchState;
+  vguard<vguard<ProductTrans> > searchTrans;
+  vguard<StateIndex> toVisit;
+  auto visit = [&] (StateIndex i, StateIndex j) -> StateIndex {
+    const auto iter = expanded.find (i * jStates + j);
+    if (iter != expanded.end())
+      return iter->second;
+    const StateIndex c = searchState.size();
+    expanded[i * jStates + j] = c;
+    searchState.push_back (pair<StateIndex,StateIndex> (i, j));
+    toVisit.push_back (c);
+    return c;
+  };
+  visit (first.startState(), second.startState());
+  while (!toVisit.empty()) {
+    const StateIndex c = toVisit.back();
+    toVisit.pop_back();
+    const StateIndex i = searchState[c].first, j = searchState[c].second;
+    const MachineState& msi = first.state[i];
+    const MachineState& msj = second.state[j];
+    vguard<ProductTrans> trans;
+    map<tuple<StateIndex,InputToken,OutputToken>,size_t> transIndex;
+    auto addPath = [&] (MachineSymbol in, MachineSymbol out, StateIndex di, StateIndex dj, ComponentTransIndex firstTrans, ComponentTransIndex secondTrans) {
+      const ProductTrans pt = { inputTokenizer.token(in), outputTokenizer.token(out), visit (di, dj), {} };
+      const auto key = make_tuple (pt.dest, pt.in, pt.out);
+      if (!transIndex.count (key)) {
+	transIndex[key] = trans.size();
+	trans.push_back (pt);
+      }
+      trans[transIndex.at(key)].path.push_back (pair<ComponentTransIndex,ComponentTransIndex> (firstTrans, secondTrans));
+    };
+    if (msj.waits() || msj.terminates()) {
+      ComponentTransIndex firstTrans = firstOffset[i];
+      for (const auto& it: msi.trans) {
+	if (it.outputEmpty())
+	  addPath (it.in, MachineSymbol(), it.dest, j, firstTrans, NoTrans);
+	else
+	  for (const auto jt: secondIndex.transitions (j, it.out))
+	    addPath (it.in, jt->out, it.dest, jt->dest, firstTrans, secondTransIndex.at (jt));
+	++firstTrans;
+      }
+    } else {
+      ComponentTransIndex secondTrans = secondOffset[j];
+      for (const auto& jt: msj.trans)
+	addPath (MachineSymbol(), jt.out, i, jt.dest, NoTrans, secondTrans++);
+    }
+    searchTrans.resize (searchState.size());
+    searchTrans[c].swap (trans);
+  }
+  const StateIndex nSearch = searchState.size();
+
+  // keep only states from which the end state can be reached
+  const auto endIter = expanded.find (first.endState() * jStates + second.endState());
+  Require (endIter != expanded.end(), "Composite end state is inaccessible");
+  const StateIndex endSearch = endIter->second;
+  vguard<vguard<StateIndex> > sources (nSearch);
+  for (StateIndex c = 0; c < nSearch; ++c)
+    for (const auto& pt: searchTrans[c])
+      sources[pt.dest].push_back (c);
+  vguard<bool> keep (nSearch, false);
+  deque<StateIndex> backQueue;
+  backQueue.push_back (endSearch);
+  keep[endSearch] = true;
+  while (backQueue.size()) {
+    const StateIndex c = backQueue.front();
+    backQueue.pop_front();
+    for (StateIndex src: sources[c])
+      if (!keep[src]) {
+	keep[src] = true;
+	backQueue.push_back (src);
+      }
+  }
+  Require (keep[0], "Composite end state is inaccessible");
+
+  // sort states so that silent transitions go from lower to higher states, with the start state first & the end state last.
+  // Ties are broken by (first's state, second's state), as in Machine::compose
+  auto isSilent = [&] (StateIndex c, const ProductTrans& pt) {
+    return keep[pt.dest] && !pt.in && !pt.out && !(pt.dest == c && c == 0);
+  };
+  vguard<size_t> nSilentIn (nSearch, 0);
+  StateIndex nKept = 0;
+  bool endSilentOut = false;
+  for (StateIndex c = 0; c < nSearch; ++c)
+    if (keep[c]) {
+      ++nKept;
+      for (const auto& pt: searchTrans[c])
+	if (isSilent (c, pt)) {
+	  endSilentOut = endSilentOut || c == endSearch;
+	  ++nSilentIn[pt.dest];
+	}
+    }
+  if (endSilentOut || nSilentIn[0] > 0) {
+    LogThisAt(3,"Composite start state has silent incoming transitions, or end state has silent outgoing transitions; can't keep the composition factored" << endl);
+    return;
+  }
+  typedef pair<StateIndex,StateIndex> KeyState;
+  priority_queue<KeyState,vector<KeyState>,greater<KeyState> > ready;
+  for (StateIndex c = 0; c < nSearch; ++c)
+    if (keep[c] && nSilentIn[c] == 0 && c != endSearch)
+      ready.push (KeyState (searchState[c].first * jStates + searchState[c].second, c));
+  vguard<StateIndex> order;
+  order.reserve (nKept);
+  while (!ready.empty()) {
+    const StateIndex c = ready.top().second;
+    ready.pop();
+    order.push_back (c);
+    for (const auto& pt: searchTrans[c])
+      if (isSilent (c, pt) && --nSilentIn[pt.dest] == 0 && pt.dest != endSearch)
+	ready.push (KeyState (searchState[pt.dest].first * jStates + searchState[pt.dest].second, pt.dest));
+  }
+  if (nSilentIn[endSearch] == 0)
+    order.push_back (endSearch);
+  if (order.size() < nKept) {
+    LogThisAt(3,"Composite machine has a cycle of silent transitions; can't keep the composition factored" << endl);
+    return;
+  }
+  advancing = true;
+
+  vguard<StateIndex> search2product (nSearch);
+  for (StateIndex s = 0; s < nKept; ++s)
+    search2product[order[s]] = s;
+  productState.reserve (nKept);
+  productTrans.resize (nKept);
+  for (StateIndex s = 0; s < nKept; ++s) {
+    const StateIndex c = order[s];
+    productState.push_back (searchState[c]);
+    for (auto& pt: searchTrans[c])
+      if (keep[pt.dest]) {
+	productTrans[s].push_back (pt);
+	productTrans[s].back().dest = search2product[pt.dest];
+      }
+  }
+
+  LogThisAt(3,"Expanded " << nSearch << " composite states, of which " << nKept << " (with " << nTransitions() << " transitions) can reach the end state" << endl);
+}
+
+StateIndex FactoredComposition::nStates() const {
+  return productState.size();
+}
+
+size_t FactoredComposition::nTransitions() const {
+  size_t n = 0;
+  for (const auto& trans: productTrans)
+    n += trans.size();
+  return n;
+}
+
+vguard<LogWeight> FactoredComposition::componentLogWeights (const Params& params) const {
+  WeightTape tape (params.defs);
+  for (const auto& w: componentWeight)
+    tape.compile (w);
+  vguard<double> paramValue, reg;
+  tape.slotValues (params.defs, paramValue);
+  tape.eval (paramValue, reg);
+  vguard<LogWeight> lw;
+  lw.reserve (componentWeight.size());
+  for (size_t n = 0; n < componentWeight.size(); ++n)
+    lw.push_back (log (tape.value (reg, n)));
+  return lw;
+}
+
+static inline LogWeight pathLogWeight (const vguard<LogWeight>& lw, const pair<FactoredComposition::ComponentTransIndex,FactoredComposition::ComponentTransIndex>& path) {
+  return (path.first == FactoredComposition::NoTrans ? 0. : lw[path.first]) + (path.second == FactoredComposition::NoTrans ? 0. : lw[path.second]);
+}
+
+// parallel paths are summed in probability space, relative to the largest
+static LogWeight transLogWeight (const vguard<LogWeight>& lw, const vguard<pair<FactoredComposition::ComponentTransIndex,FactoredComposition::ComponentTransIndex> >& paths) {
+  if (paths.size() == 1)
+    return pathLogWeight (lw, paths.front());
+  LogWeight maxLogWeight = -numeric_limits<double>::infinity();
+  for (const auto& path: paths)
+    maxLogWeight = max (maxLogWeight, pathLogWeight (lw, path));
+  if (maxLogWeight == -numeric_limits<double>::infinity())
+    return maxLogWeight;
+  double w = 0;
+  for (const auto& path: paths)
+    w += exp (pathLogWeight (lw, path) - maxLogWeight);
+  return maxLogWeight + log (w);
+}
+
+EvaluatedMachine FactoredComposition::evaluate (const Params& params) const {
+  Assert (advancing, "Factored composition can't be evaluated");
+  const vguard<LogWeight> lw = componentLogWeights (params);
+  vguard<StateName> stateName;
+  vguard<vguard<EvaluatedMachine::TokenTrans> > trans (nStates());
+  stateName.reserve (nStates());
+  for (StateIndex s = 0; s < nStates(); ++s) {
+    stateName.push_back (StateName ({first.state[productState[s].first].name, second.state[productState[s].second].name}));
+    trans[s].reserve (productTrans[s].size());
+    for (const auto& pt: productTrans[s])
+      trans[s].push_back (EvaluatedMachine::TokenTrans { pt.in, pt.out, pt.dest, transLogWeight (lw, pt.path) });
+  }
+  return EvaluatedMachine (inputAlphabet, outputAlphabet, stateName, trans);
+}
+
+Machine FactoredComposition::componentMachine() const {
+  Machine m;
+  m.state = first.state;
+  m.state.insert (m.state.end(), second.state.begin(), second.state.end());
+  return m;
+}
+
+// A product transition's count is shared among its paths in proportion to their weights
+MachineCounts FactoredComposition::componentCounts (const MachineCounts& productCounts, const Params& params) const {
+  Assert (productCounts.count.size() == nStates(), "Number of states mismatch");
+  const vguard<LogWeight> lw = componentLogWeights (params);
+  MachineCounts counts;
+  counts.count.resize (first.nStates() + second.nStates());
+  for (StateIndex s = 0; s < first.nStates(); ++s)
+    counts.count[s].resize (first.state[s].trans.size(), 0.);
+  for (StateIndex s = 0; s < second.nStates(); ++s)
+    counts.count[first.nStates() + s].resize (second.state[s].trans.size(), 0.);
+  auto addCount = [&] (ComponentTransIndex n, double c) {
+    if (n != NoTrans)
+      counts.count[componentTransPos[n].first][componentTransPos[n].second] += c;
+  };
+  for (StateIndex s = 0; s < nStates(); ++s) {
+    Assert (productCounts.count[s].size() == productTrans[s].size(), "State size mismatch");
+    for (size_t t = 0; t < productTrans[s].size(); ++t) {
+      const double c = productCounts.count[s][t];
+      if (c == 0)
+	continue;
+      const auto& paths = productTrans[s][t].path;
+      const LogWeight transLW = transLogWeight (lw, paths);
+      for (const auto& path: paths) {
+	const double pathCount = paths.size() == 1 ? c : (c * exp (pathLogWeight (lw, path) - transLW));
+	addCount (path.first, pathCount);
+	addCount (path.second, pathCount);
+      }
+    }
+  }
+  return counts;
+}
@@ -0,0 +1,53 @@
+#ifndef FACTORED_INCLUDED
+#define FACTORED_INCLUDED
+
+#include "machine.h"
+#include "eval.h"
+#include "counts.h"
+
+// A composition A=>B whose transitions are kept as the pairs of component transitions they are made from, so no WeightExpr is built for a product transition.
+// The accessible product states are all expanded at construction, by search from the start state (parallel transitions are merged, as in Machine::compose),
+// then sorted so that silent transitions go from lower to higher states, as the DP matrices need (the components are made advancing first, as compose's result is).
+// Each evaluation evaluates the component machines' weights, and sums them along the stored transition pairs.
+// Counts of product transitions are shared out among the component transitions they are made from, so the M-step is done on the components
+class FactoredComposition {
+public:
+  typedef size_t ComponentTransIndex;  // first's transitions in order, then second's
+  static const ComponentTransIndex NoTrans = (ComponentTransIndex) -1;
+
+  FactoredComposition (const Machine& first, const Machine& second);
+
+  // false if the product states can't be sorted as an advancing machine's (e.g. there is a cycle of silent transitions, such as an insertion by first deleted by second),
+  // in which case the composition must be built with Machine::compose, whose advancingMachine step sums over the cycles
+  bool advancing;
+
+  StateIndex nStates() const;
+  size_t nTransitions() const;
+
+  EvaluatedMachine evaluate (const Params& params) const;
+
+  // a machine with the states of first, then those of second, for the M-step (only its transition weights are meaningful)
+  Machine componentMachine() const;
+  // counts of componentMachine()'s transitions, given counts of the product transitions of evaluate(params)
+  MachineCounts componentCounts (const MachineCounts& productCounts, const Params& params) const;
+
+private:
+  struct ProductTrans {
+    InputToken in;
+    OutputToken out;
+    StateIndex dest;
+    vguard<pair<ComponentTransIndex,ComponentTransIndex> > path;  // (first's, second's) transition pairs that this sums over; either may be NoTrans
+  };
+
+  Machine first, second;  // both advancing; second is a waiting machine
+  vguard<InputSymbol> inputAlphabet;
+  vguard<OutputSymbol> outputAlphabet;
+  vguard<WeightExpr> componentWeight;  // indexed by ComponentTransIndex
+  vguard<pair<StateIndex,size_t> > componentTransPos;  // componentMachine() state and transition index, by ComponentTransIndex
+  vguard<pair<StateIndex,StateIndex> > productState;  // (first's, second's) state, by product state
+  vguard<vguard<ProductTrans> > productTrans;  // by product state
+
+  vguard<LogWeight> componentLogWeights (const Params& params) const;
+};
+
+#endif /* FACTORED_INCLUDED */
@@ -2,19 +2,44 @@
 #include "eval.h"
 #include "counts.h"
 #include "logger.h"
+#include "workers.h"
 
 #define MaxEMIterations 1000
 #define MinEMImprovement .001
+#define MaxPendingPerThread 4
+
+MachineFitter::MachineFitter() :
+  threads (1)
+{ }
 
 Params MachineFitter::fit (const SeqPairList& trainingSet) const {
+  const vguard<SeqPair> seqPairs (trainingSet.seqPairs.begin(), trainingSet.seqPairs.end());
+  const size_t nThreads = max ((size_t) 1, min (threads, seqPairs.size()));
+  const Machine objectiveMachine = factored ? factored->componentMachine() : machine;
   Params params = seed;
+  // the machine's weights are compiled once, as only the parameter values change between iterations
+  const WeightTape weightTape = factored ? WeightTape() : EvaluatedMachine::compileWeights (machine, constants.combine (params).defs);
   double prev;
   for (size_t iter = 0; true; ++iter) {
-    const EvaluatedMachine eval (machine, constants.combine (params));
+    const EvaluatedMachine eval = factored ? factored->evaluate (constants.combine (params)) : EvaluatedMachine (machine, weightTape, constants.combine (params).defs);
     MachineCounts counts (eval);
     double loglike = 0;
-    for (const auto& seqPair: trainingSet.seqPairs)
-      loglike += counts.add (eval, seqPair);
+    if (nThreads == 1)
+      for (const auto& seqPair: seqPairs)
+	loglike += counts.add (eval, seqPair, dpOptions);
+    else
+      // each sequence pair's counts are found separately, then added to the total (and its log-likelihood to the total log-likelihood) in input order,
+      // so the sums are the same for any number of worker threads. They can differ from the serial sums in the last bits, as those add each pair's counts straight into the total
+      runInOrder<pair<double,MachineCounts> > (seqPairs.size(), nThreads, nThreads * MaxPendingPerThread, "E-step",
+					       [&] (size_t n) {
+						 MachineCounts pairCounts (eval);
+						 const double ll = pairCounts.add (eval, seqPairs[n], dpOptions);
+						 return make_pair (ll, move (pairCounts));
+					       },
+					       [&] (size_t n, const pair<double,MachineCounts>& pairResult) {
+						 loglike += pairResult.first;
+						 counts += pairResult.second;
+					       });
     LogThisAt(2,"Baum-Welch iteration #" << (iter+1) << ": log-likelihood " << loglike << endl);
     LogThisAt(4,"Parameters:" << endl << JsonWriter<Params>::toJsonString(params) << endl);
     if (iter > 0) {
@@ -24,7 +49,10 @@ Params MachineFitter::fit (const SeqPairList& trainingSet) const {
       if (improvement < MinEMImprovement)
 	break;
     }
-    MachineObjective objective (machine, counts, constraints, constants);
+    // the M-step for a lazily composed machine is done on its components, whose weights its transitions' are products of
+    if (factored)
+      counts = factored->componentCounts (counts, constants.combine (params));
+    MachineObjective objective (objectiveMachine, counts, constraints, constants);
     params = objective.optimize (params);
     prev = loglike;
   }
@@ -1,15 +1,23 @@
 #ifndef FITTER_INCLUDED
 #define FITTER_INCLUDED
 
+#include <memory>
 #include "machine.h"
+#include "factored.h"
 #include "params.h"
 #include "constraints.h"
 #include "seqpair.h"
+#include "dpmatrix.h"
 
 struct MachineFitter {
   Machine machine;
+  shared_ptr<const FactoredComposition> factored;  // if set, this composition is fitted instead of machine, without being built
   Constraints constraints;
   Params seed, constants;
+  size_t threads;  // number of E-step worker threads
+  DPOptions dpOptions;
+
+  MachineFitter();
 
   Params fit (const SeqPairList& trainingSet) const;
 };
@@ -1,30 +1,23 @@
 #include "forward.h"
 #include "logger.h"
 
-ForwardMatrix::ForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
-  DPMatrix (machine, seqPair)
+template<class Cell>
+ForwardMatrix<Cell>::ForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  DPMatrix<Cell> (machine, seqPair, options)
 {
-  for (InputIndex inPos = 0; inPos <= inLen; ++inPos) {
-    const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
-    for (OutputIndex outPos = 0; outPos <= outLen; ++outPos) {
-      const OutputToken outTok = outPos ? output[outPos-1] : OutputTokenizer::emptyToken();
-      for (StateIndex d = 0; d < nStates; ++d) {
-	const EvaluatedMachineState& state = machine.state[d];
-	double ll = (inPos || outPos || d) ? -numeric_limits<double>::infinity() : 0;
-	if (inPos && outPos)
-	  accumulate (ll, state.incoming, inTok, outTok, inPos - 1, outPos - 1, sum_reduce);
-	if (inPos)
-	  accumulate (ll, state.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos, sum_reduce);
-	if (outPos)
-	  accumulate (ll, state.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1, sum_reduce);
-	accumulate (ll, state.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, sum_reduce);
-	cell(inPos,outPos,d) = ll;
-      }
-    }
-  }
+  this->template fillIncoming<SumProductSemiring>();
   LogThisAt(8,"Forward matrix:" << endl << *this);
 }
 
-double ForwardMatrix::logLike() const {
-  return cell (inLen, outLen, machine.endState());
+template<class Cell>
+double ForwardMatrix<Cell>::logLike() const {
+  return this->cell (this->inLen, this->outLen, this->machine.endState());
 }
+
+template<class Cell>
+void ForwardMatrix<Cell>::storeRow (InputIndex inPos) {
+  this->template readyRow<SumProductSemiring> (inPos);
+}
+
+template struct ForwardMatrix<float>;
+template struct ForwardMatrix<double>;
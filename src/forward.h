@@ -3,9 +3,12 @@
 
 #include "dpmatrix.h"
 
-struct ForwardMatrix : DPMatrix {
-  ForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair);
+template<class Cell>
+struct ForwardMatrix : DPMatrix<Cell> {
+  typedef typename DPMatrix<Cell>::InputIndex InputIndex;
+  ForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options = DPOptions());
   double logLike() const;
+  void storeRow (InputIndex inPos);  // if checkpointed, refills the block containing row inPos; rows should be requested in decreasing order
 };
 
 #endif /* FORWARD_INCLUDED */
@@ -1,8 +1,10 @@
 #include <iostream>
+#include <cstring>
 #include <gsl/gsl_randist.h>
 #include "logsumexp.h"
 #include "util.h"
 
+#if !defined(LOG_SUM_EXP_SLOW) && !defined(LOG_SUM_EXP_POLY)
 LogSumExpLookupTable logSumExpLookupTable = LogSumExpLookupTable();
 
 LogSumExpLookupTable::LogSumExpLookupTable() {
@@ -18,6 +20,34 @@ LogSumExpLookupTable::LogSumExpLookupTable() {
 LogSumExpLookupTable::~LogSumExpLookupTable() {
   delete[] lookup;
 }
+#endif
+
+LogSumExpPolyTable logSumExpPolyTable = LogSumExpPolyTable();
+
+/* Newton interpolation at the Chebyshev nodes of [-1,1], expanded into powers of u = 2t and rescaled to powers of t, all in long double */
+LogSumExpPolyTable::LogSumExpPolyTable() {
+  const int nCoeffs = LOG_SUM_EXP_POLY_DEGREE + 1;
+  const long double pi = acosl (-1.L);
+  long double node[nCoeffs], divDiff[nCoeffs], uCoeff[nCoeffs];
+  for (int k = 0; k < nCoeffs; ++k)
+    node[k] = cosl (pi * (k + .5L) / nCoeffs);
+  for (int n = 0; n < LOG_SUM_EXP_POLY_MAX; ++n) {
+    for (int k = 0; k < nCoeffs; ++k)
+      divDiff[k] = log1pl (expl (-(n + .5L + node[k] / 2)));
+    for (int j = 1; j < nCoeffs; ++j)
+      for (int k = nCoeffs - 1; k >= j; --k)
+	divDiff[k] = (divDiff[k] - divDiff[k-1]) / (node[k] - node[k-j]);
+    for (int k = 0; k < nCoeffs; ++k)
+      uCoeff[k] = 0;
+    for (int k = nCoeffs - 1; k >= 0; --k) {
+      for (int i = nCoeffs - 1; i > 0; --i)
+	uCoeff[i] = uCoeff[i-1] - node[k] * uCoeff[i];
+      uCoeff[0] = divDiff[k] - node[k] * uCoeff[0];
+    }
+    for (int i = 0; i < nCoeffs; ++i)
+      coeff[n][i] = (double) ldexpl (uCoeff[i], i);
+  }
+}
 
 double log_sum_exp_slow (double a, double b) {
   double min, max, diff, ret;
@@ -53,6 +83,117 @@ double log_accum_exp_slow (double& a, double b) {
   return a;
 }
 
+/* Constants for exp(x), x <= 0: x = k*log(2) + r with |r| <= log(2)/2, exp(r) is a Taylor series to r^13 (relative error < 2e-16), and 2^k is built from its bits.
+   Adding 1.5*2^52 rounds x/log(2) to an integer k held in the low mantissa bits. Inputs below -708, where 2^k would not be a normal double, give 0 */
+#define EXP_MIN_ARG -708.
+#define EXP_ROUNDING_SHIFT 6755399441055744.
+#define EXP_LOG2E 1.4426950408889634
+#define EXP_LN2_HI 6.93145751953125e-1
+#define EXP_LN2_LO 1.42860682030941723212e-6
+#define EXP_TAYLOR_TERMS 14
+static const double expTaylorCoeff[EXP_TAYLOR_TERMS] = { 1./6227020800., 1./479001600., 1./39916800., 1./3628800., 1./362880., 1./40320., 1./5040., 1./720., 1./120., 1./24., 1./6., .5, 1., 1. };
+
+static inline double exp_nonpositive (double x) {
+  if (x < EXP_MIN_ARG)
+    return 0;
+  const double shifted = x * EXP_LOG2E + EXP_ROUNDING_SHIFT;
+  const double k = shifted - EXP_ROUNDING_SHIFT;
+  const double r = (x - k * EXP_LN2_HI) - k * EXP_LN2_LO;
+  double p = expTaylorCoeff[0];
+  for (int n = 1; n < EXP_TAYLOR_TERMS; ++n)
+    p = p * r + expTaylorCoeff[n];
+  long long shiftedBits, shiftBits, scaleBits;
+  const double shift = EXP_ROUNDING_SHIFT;
+  memcpy (&shiftedBits, &shifted, sizeof(double));
+  memcpy (&shiftBits, &shift, sizeof(double));
+  scaleBits = (shiftedBits - shiftBits + 1023) << 52;
+  double scale;
+  memcpy (&scale, &scaleBits, sizeof(double));
+  return p * scale;
+}
+
+static double log_sum_exp_batch_scalar (const double* x, size_t n, double max) {
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i)
+    sum += exp_nonpositive (x[i] - max);
+  return sum;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LOG_SUM_EXP_NO_SIMD)
+#include <immintrin.h>
+
+/* The vector versions follow the scalar code, with fused multiply-adds */
+__attribute__((target("avx2,fma")))
+static double log_sum_exp_batch_avx2 (const double* x, size_t n, double max) {
+  const __m256d vmax = _mm256_set1_pd (max), minArg = _mm256_set1_pd (EXP_MIN_ARG), shift = _mm256_set1_pd (EXP_ROUNDING_SHIFT);
+  const __m256i bias = _mm256_sub_epi64 (_mm256_set1_epi64x (1023), _mm256_castpd_si256 (shift));
+  __m256d sum = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d d = _mm256_sub_pd (_mm256_loadu_pd (x + i), vmax);
+    const __m256d underflow = _mm256_cmp_pd (d, minArg, _CMP_LT_OQ);
+    const __m256d dc = _mm256_max_pd (d, minArg);
+    const __m256d shifted = _mm256_fmadd_pd (dc, _mm256_set1_pd (EXP_LOG2E), shift);
+    const __m256d k = _mm256_sub_pd (shifted, shift);
+    const __m256d r = _mm256_fnmadd_pd (k, _mm256_set1_pd (EXP_LN2_LO), _mm256_fnmadd_pd (k, _mm256_set1_pd (EXP_LN2_HI), dc));
+    __m256d p = _mm256_set1_pd (expTaylorCoeff[0]);
+    for (int t = 1; t < EXP_TAYLOR_TERMS; ++t)
+      p = _mm256_fmadd_pd (p, r, _mm256_set1_pd (expTaylorCoeff[t]));
+    const __m256d scale = _mm256_castsi256_pd (_mm256_slli_epi64 (_mm256_add_epi64 (_mm256_castpd_si256 (shifted), bias), 52));
+    sum = _mm256_add_pd (sum, _mm256_andnot_pd (underflow, _mm256_mul_pd (p, scale)));
+  }
+  double lanes[4];
+  _mm256_storeu_pd (lanes, sum);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + log_sum_exp_batch_scalar (x + i, n - i, max);
+}
+
+__attribute__((target("avx512f")))
+static double log_sum_exp_batch_avx512 (const double* x, size_t n, double max) {
+  const __m512d vmax = _mm512_set1_pd (max), minArg = _mm512_set1_pd (EXP_MIN_ARG), shift = _mm512_set1_pd (EXP_ROUNDING_SHIFT);
+  const __m512i bias = _mm512_sub_epi64 (_mm512_set1_epi64 (1023), _mm512_castpd_si512 (shift));
+  __m512d sum = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512d d = _mm512_sub_pd (_mm512_loadu_pd (x + i), vmax);
+    const __mmask8 inRange = _mm512_cmp_pd_mask (d, minArg, _CMP_GE_OQ);
+    const __m512d dc = _mm512_max_pd (d, minArg);
+    const __m512d shifted = _mm512_fmadd_pd (dc, _mm512_set1_pd (EXP_LOG2E), shift);
+    const __m512d k = _mm512_sub_pd (shifted, shift);
+    const __m512d r = _mm512_fnmadd_pd (k, _mm512_set1_pd (EXP_LN2_LO), _mm512_fnmadd_pd (k, _mm512_set1_pd (EXP_LN2_HI), dc));
+    __m512d p = _mm512_set1_pd (expTaylorCoeff[0]);
+    for (int t = 1; t < EXP_TAYLOR_TERMS; ++t)
+      p = _mm512_fmadd_pd (p, r, _mm512_set1_pd (expTaylorCoeff[t]));
+    const __m512d scale = _mm512_castsi512_pd (_mm512_slli_epi64 (_mm512_add_epi64 (_mm512_castpd_si512 (shifted), bias), 52));
+    sum = _mm512_mask_add_pd (sum, inRange, sum, _mm512_mul_pd (p, scale));
+  }
+  return _mm512_reduce_add_pd (sum) + log_sum_exp_batch_scalar (x + i, n - i, max);
+}
+#endif
+
+typedef double (*LogSumExpBatchSum) (const double*, size_t, double);
+
+/* chooses the widest instruction set that the CPU supports */
+static LogSumExpBatchSum log_sum_exp_batch_kernel() {
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LOG_SUM_EXP_NO_SIMD)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports ("avx512f"))
+    return log_sum_exp_batch_avx512;
+  if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+    return log_sum_exp_batch_avx2;
+#endif
+  return log_sum_exp_batch_scalar;
+}
+
+double log_sum_exp_batch (const double* x, size_t n) {
+  static const LogSumExpBatchSum kernel = log_sum_exp_batch_kernel();
+  double max = -numeric_limits<double>::infinity();
+  for (size_t i = 0; i < n; ++i)
+    max = x[i] > max ? x[i] : max;
+  if (max == -numeric_limits<double>::infinity() || max == numeric_limits<double>::infinity() || std::isnan(max))
+    return max;
+  return max + log (kernel (x, n, max));
+}
+
 vguard<LogProb> log_vector (const vguard<double>& v) {
   return transform_container<double,vguard<double> > (v, log);
 }
@@ -1,19 +1,27 @@
 #include <iomanip>
 #include <fstream>
 #include <set>
+#include <unordered_set>
+#include <unordered_map>
+#include <tuple>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <queue>
 #include <json.hpp>
 
 #include "machine.h"
 #include "fastseq.h"
 #include "logger.h"
 #include "schema.h"
+#include "workers.h"
 
 using json = nlohmann::json;
 
 MachineTransition::MachineTransition()
 { }
 
-MachineTransition::MachineTransition (InputSymbol in, OutputSymbol out, StateIndex dest, WeightExpr weight)
+MachineTransition::MachineTransition (MachineSymbol in, MachineSymbol out, StateIndex dest, WeightExpr weight)
   : in (in),
   out (out),
   dest (dest),
@@ -121,21 +129,25 @@ string Machine::stateNameJson (StateIndex s) const {
 }
 
 vguard<InputSymbol> Machine::inputAlphabet() const {
-  set<InputSymbol> alph;
+  unordered_set<MachineSymbol> alph;
   for (const auto& ms: state)
     for (const auto& t: ms.trans)
       if (!t.inputEmpty())
 	alph.insert (t.in);
-  return vguard<InputSymbol> (alph.begin(), alph.end());
+  vguard<InputSymbol> alphVec (alph.begin(), alph.end());
+  sort (alphVec.begin(), alphVec.end());
+  return alphVec;
 }
 
 vguard<OutputSymbol> Machine::outputAlphabet() const {
-  set<OutputSymbol> alph;
+  unordered_set<MachineSymbol> alph;
   for (const auto& ms: state)
     for (const auto& t: ms.trans)
       if (!t.outputEmpty())
 	alph.insert (t.out);
-  return vguard<OutputSymbol> (alph.begin(), alph.end());
+  vguard<OutputSymbol> alphVec (alph.begin(), alph.end());
+  sort (alphVec.begin(), alphVec.end());
+  return alphVec;
 }
 
 void Machine::writeJson (ostream& out) const {
@@ -297,54 +309,89 @@ inline StateIndex compState2j (StateIndex comp, StateIndex jStates) {
   return comp % jStates;
 }
 
-Machine Machine::compose (const Machine& first, const Machine& origSecond, bool assignCompositeStateNames, bool collapseDegenerateTransitions) {
+// Calls visit(k) for k = 0..n-1, handing out blocks of indices to the pool's threads as they become free.
+// Only the calling thread calls progress(k)
+static void forEachIndex (size_t n, WorkerPool& pool, const function<void(size_t)>& visit, const function<void(size_t)>& progress) {
+  const size_t blockSize = 64;
+  atomic<size_t> nextBlock (0);
+  pool.run (max ((size_t) 1, min (pool.size(), (n + blockSize - 1) / blockSize)), [&] (size_t w) {
+      for (size_t block; (block = nextBlock++) * blockSize < n; )
+	for (size_t k = block * blockSize; k < min (n, (block + 1) * blockSize); ++k) {
+	  if (w == 0)
+	    progress (k);
+	  visit (k);
+	}
+    });
+}
+
+// Sparse map from product state i*jStates+j to its index among the kept states, so memory scales with the accessible states rather than iStates*jStates
+typedef unordered_map<StateIndex,StateIndex> ProductStateMap;
+
+// Breadth-first search of the product states accessible from (0,0), where getDests(c,dest) appends the successors of product state c to dest.
+// Returns the accessible states in ascending order, and fills comp2kept with their positions in that order.
+// With a pool of more than one thread, each level's states are expanded concurrently, then merged in order, so the same states are found
+static vguard<StateIndex> accessibleProductStates (StateIndex iStates, StateIndex jStates, WorkerPool& pool, const function<void(StateIndex,vguard<StateIndex>&)>& getDests, ProductStateMap& comp2kept) {
+  LogThisAt(6,"Finding accessible states" << endl);
+  vguard<StateIndex> frontier, keptState;
+  vguard<vguard<StateIndex> > dest (pool.size());
+  frontier.push_back(0);
+  comp2kept.clear();
+  comp2kept[0] = 0;
+  ProgressLog(plogAcc,6);
+  plogAcc.initProgress ("Performing breadth-first search of state space (max %lu states)", iStates*jStates);
+  while (!frontier.empty()) {
+    plogAcc.logProgress (keptState.size() / (double) (iStates*jStates), "visited %lu states", keptState.size());
+    keptState.insert (keptState.end(), frontier.begin(), frontier.end());
+    const size_t nWorkers = min (pool.size(), frontier.size() / 64 + 1);
+    pool.run (nWorkers, [&] (size_t w) {
+	dest[w].clear();
+	for (size_t n = frontier.size() * w / nWorkers; n < frontier.size() * (w + 1) / nWorkers; ++n)
+	  getDests (frontier[n], dest[w]);
+      });
+    frontier.clear();
+    for (size_t w = 0; w < nWorkers; ++w)
+      for (const StateIndex d: dest[w])
+	if (comp2kept.insert (ProductStateMap::value_type (d, 0)).second)
+	  frontier.push_back(d);
+  }
+
+  LogThisAt(7,"Sorting & indexing " << keptState.size() << " states" << endl);
+  sort (keptState.begin(), keptState.end());
+  for (StateIndex k = 0; k < keptState.size(); ++k)
+    comp2kept[keptState[k]] = k;
+  return keptState;
+}
+
+// With threads > 1, the accessibility search is level-synchronous, and the states' names and transitions are built concurrently, all on one WorkerPool. Each composite state depends only on its pair of component states,
+// and the kept states are sorted before they are numbered, so the result is identical to the serial version's
+Machine Machine::compose (const Machine& first, const Machine& origSecond, bool assignCompositeStateNames, bool collapseDegenerateTransitions, size_t threads) {
   LogThisAt(3,"Composing " << first.nStates() << "-state transducer with " << origSecond.nStates() << "-state transducer" << endl);
   const Machine second = origSecond.isWaitingMachine() ? origSecond : origSecond.waitingMachine();
   Assert (second.isWaitingMachine(), "Attempt to compose transducers A*B where B is not a waiting machine");
 
   const StateIndex iStates = first.nStates(), jStates = second.nStates();
+  const MachineInputIndex secondIndex (second);
+  WorkerPool pool (max ((size_t) 1, threads), "compose");
 
-  // first, a quick optimization hack to filter out inaccessible states
-  LogThisAt(6,"Finding accessible states" << endl);
-  vguard<bool> keep (iStates * jStates, false);
-  vguard<StateIndex> toVisit, dest, keptState;
-  keptState.reserve (iStates * jStates);
-  toVisit.push_back(0);
-  keep[0] = true;
-  ProgressLog(plogAcc,6);
-  plogAcc.initProgress ("Performing depth-first search of state space (max %lu states)", iStates*jStates);
-  while (!toVisit.empty()) {
-    plogAcc.logProgress (keptState.size() / (double) (iStates*jStates), "visited %lu states", keptState.size());
-    const StateIndex c = toVisit.back();
-    toVisit.pop_back();
-    keptState.push_back(c);
+  auto getDests = [&] (StateIndex c, vguard<StateIndex>& dest) {
     const StateIndex i = compState2i(c,jStates), j = compState2j(c,jStates);
     const MachineState& msi = first.state[i];
     const MachineState& msj = second.state[j];
-    dest.clear();
     if (msj.waits() || msj.terminates()) {
       for (const auto& it: msi.trans)
 	if (it.outputEmpty())
 	  dest.push_back (ij2compState(it.dest,j,jStates));
 	else
-	  for (const auto& jt: msj.trans)
-	    if (it.out == jt.in)
-	      dest.push_back (ij2compState(it.dest,jt.dest,jStates));
+	  for (const auto jt: secondIndex.transitions (j, it.out))
+	    dest.push_back (ij2compState(it.dest,jt->dest,jStates));
     } else
       for (const auto& jt: msj.trans)
 	dest.push_back (ij2compState(i,jt.dest,jStates));
-    for (const StateIndex d: dest)
-      if (!keep[d]) {
-	keep[d] = true;
-	toVisit.push_back(d);
-      }
-  }
+  };
 
-  LogThisAt(7,"Sorting & indexing " << keptState.size() << " states" << endl);
-  sort (keptState.begin(), keptState.end());
-  vguard<StateIndex> comp2kept (iStates * jStates);
-  for (StateIndex k = 0; k < keptState.size(); ++k)
-    comp2kept[keptState[k]] = k;
+  // first, a quick optimization hack to filter out inaccessible states
+  ProductStateMap comp2kept;
+  const vguard<StateIndex> keptState = accessibleProductStates (iStates, jStates, pool, getDests, comp2kept);
 
   // now do the composition for real
   Machine compMachine;
@@ -355,54 +402,50 @@ Machine Machine::compose (const Machine& first, const Machine& origSecond, bool
   if (assignCompositeStateNames) {
     ProgressLog(plogName,6);
     plogName.initProgress ("Constructing namespace (%lu states)", keptState.size());
-    for (StateIndex k = 0; k < keptState.size(); ++k) {
-      const StateIndex c = keptState[k];
-      const StateIndex i = compState2i(c,jStates), j = compState2j(c,jStates);
-      const MachineState& msi = first.state[i];
-      const MachineState& msj = second.state[j];
-      plogName.logProgress (k / (double) keptState.size(), "state %ld/%ld", k, keptState.size());
-      MachineState& ms = comp[k];
-      ms.name = StateName ({first.state[i].name, second.state[j].name});
-    }
+    forEachIndex (keptState.size(), pool, [&] (size_t k) {
+	const StateIndex c = keptState[k];
+	const StateIndex i = compState2i(c,jStates), j = compState2j(c,jStates);
+	comp[k].name = StateName ({first.state[i].name, second.state[j].name});
+      }, [&] (size_t k) {
+	plogName.logProgress (k / (double) keptState.size(), "state %ld/%ld", k, keptState.size());
+      });
   }
 
   ProgressLog(plogTrans,6);
   plogTrans.initProgress ("Computing transition weights (%lu states)", keptState.size());
 
-  TransAccumulator ta;
-  for (StateIndex k = 0; k < keptState.size(); ++k) {
-    const StateIndex c = keptState[k];
-    const StateIndex i = compState2i(c,jStates), j = compState2j(c,jStates);
-    const MachineState& msi = first.state[i];
-    const MachineState& msj = second.state[j];
-    plogTrans.logProgress (k / (double) keptState.size(), "state %ld/%ld", k, keptState.size());
-    MachineState& ms = comp[k];
-    if (collapseDegenerateTransitions)
-      ta.clear();
-    else
-      ta.transList = &ms.trans;
-    if (msj.waits() || msj.terminates()) {
-      for (const auto& it: msi.trans)
-	if (it.outputEmpty()) {
-	  const StateIndex d = ij2compState(it.dest,j,jStates);
-	  if (keep[d])
-	    ta.accumulate (it.in, string(), comp2kept[d], it.weight);
-	} else
-	  for (const auto& jt: msj.trans)
-	    if (it.out == jt.in) {
-	      const StateIndex d = ij2compState(it.dest,jt.dest,jStates);
-	      if (keep[d])
-		ta.accumulate (it.in, jt.out, comp2kept[d], WeightAlgebra::multiply (it.weight, jt.weight));
+  forEachIndex (keptState.size(), pool, [&] (size_t k) {
+      const StateIndex c = keptState[k];
+      const StateIndex i = compState2i(c,jStates), j = compState2j(c,jStates);
+      const MachineState& msi = first.state[i];
+      const MachineState& msj = second.state[j];
+      MachineState& ms = comp[k];
+      TransAccumulator ta;
+      if (!collapseDegenerateTransitions)
+	ta.transList = &ms.trans;
+      if (msj.waits() || msj.terminates()) {
+	for (const auto& it: msi.trans)
+	  if (it.outputEmpty()) {
+	    const auto d = comp2kept.find (ij2compState(it.dest,j,jStates));
+	    if (d != comp2kept.end())
+	      ta.accumulate (it.in, string(), d->second, it.weight);
+	  } else
+	    for (const auto jt: secondIndex.transitions (j, it.out)) {
+	      const auto d = comp2kept.find (ij2compState(it.dest,jt->dest,jStates));
+	      if (d != comp2kept.end())
+		ta.accumulate (it.in, jt->out, d->second, WeightAlgebra::multiply (it.weight, jt->weight));
 	    }
-    } else
-      for (const auto& jt: msj.trans) {
-	const StateIndex d = ij2compState(i,jt.dest,jStates);
-	if (keep[d])
-	  ta.accumulate (string(), jt.out, comp2kept[d], jt.weight);
-      }
-    if (collapseDegenerateTransitions)
-      ms.trans = ta.transitions();
-  }
+      } else
+	for (const auto& jt: msj.trans) {
+	  const auto d = comp2kept.find (ij2compState(i,jt.dest,jStates));
+	  if (d != comp2kept.end())
+	    ta.accumulate (string(), jt.out, d->second, jt.weight);
+	}
+      if (collapseDegenerateTransitions)
+	ms.trans = ta.transitions();
+    }, [&] (size_t k) {
+      plogTrans.logProgress (k / (double) keptState.size(), "state %ld/%ld", k, keptState.size());
+    });
 
   LogThisAt(3,"Transducer composition yielded " << compMachine.nStates() << "-state machine" << endl);
   return compMachine.ergodicMachine().advanceSort().advancingMachine().ergodicMachine();
@@ -414,36 +457,56 @@ Machine Machine::intersect (const Machine& first, const Machine& origSecond) {
   const Machine second = origSecond.isWaitingMachine() ? origSecond : origSecond.waitingMachine();
   Assert (second.isWaitingMachine(), "Attempt to intersect transducers A&B where B is not a waiting machine");
 
-  Machine interMachine;
-  vguard<MachineState>& inter = interMachine.state;
-  inter = vguard<MachineState> (first.nStates() * second.nStates());
+  const StateIndex iStates = first.nStates(), jStates = second.nStates();
+  const MachineInputIndex secondIndex (second);
 
-  auto interState = [&](StateIndex i,StateIndex j) -> StateIndex {
-    return i * second.nStates() + j;
+  // as in compose, only the accessible product states are built
+  auto getDests = [&] (StateIndex c, vguard<StateIndex>& dest) {
+    const StateIndex i = compState2i(c,jStates), j = compState2j(c,jStates);
+    const MachineState& msi = first.state[i];
+    const MachineState& msj = second.state[j];
+    if (msj.waits() || msj.terminates()) {
+      for (const auto& it: msi.trans)
+	if (it.inputEmpty())
+	  dest.push_back (ij2compState(it.dest,j,jStates));
+	else
+	  for (const auto jt: secondIndex.transitions (j, it.in))
+	    dest.push_back (ij2compState(it.dest,jt->dest,jStates));
+    } else
+      for (const auto& jt: msj.trans)
+	dest.push_back (ij2compState(i,jt.dest,jStates));
   };
-  for (StateIndex i = 0; i < first.nStates(); ++i)
-    for (StateIndex j = 0; j < second.nStates(); ++j) {
-      MachineState& ms = inter[interState(i,j)];
-      ms.name = StateName ({first.state[i].name, second.state[j].name});
-    }
+  ProductStateMap inter2kept;
+  WorkerPool serial (1, "intersect");
+  vguard<StateIndex> keptState = accessibleProductStates (iStates, jStates, serial, getDests, inter2kept);
+  // the end state is kept even if it is inaccessible, so that ergodicMachine can report an empty intersection
+  const StateIndex endState = ij2compState (iStates - 1, jStates - 1, jStates);
+  if (!inter2kept.count (endState)) {
+    inter2kept[endState] = keptState.size();
+    keptState.push_back (endState);
+  }
 
-  for (StateIndex i = 0; i < first.nStates(); ++i)
-    for (StateIndex j = 0; j < second.nStates(); ++j) {
-      MachineState& ms = inter[interState(i,j)];
-      const MachineState& msi = first.state[i];
-      const MachineState& msj = second.state[j];
-      if (msj.waits() || msj.terminates()) {
-	for (const auto& it: msi.trans)
-	  if (it.inputEmpty())
-	    ms.trans.push_back (MachineTransition (it.in, string(), interState(it.dest,j), it.weight));
-	  else
-	    for (const auto& jt: msj.trans)
-	      if (it.in == jt.in)
-		ms.trans.push_back (MachineTransition (it.in, string(), interState(it.dest,jt.dest), WeightAlgebra::multiply (it.weight, jt.weight)));
-      } else
-	for (const auto& jt: msj.trans)
-	  ms.trans.push_back (MachineTransition (string(), string(), interState(i,jt.dest), jt.weight));
-    }
+  Machine interMachine;
+  vguard<MachineState>& inter = interMachine.state;
+  inter.resize (keptState.size());
+
+  for (StateIndex k = 0; k < keptState.size(); ++k) {
+    const StateIndex i = compState2i(keptState[k],jStates), j = compState2j(keptState[k],jStates);
+    MachineState& ms = inter[k];
+    const MachineState& msi = first.state[i];
+    const MachineState& msj = second.state[j];
+    ms.name = StateName ({msi.name, msj.name});
+    if (msj.waits() || msj.terminates()) {
+      for (const auto& it: msi.trans)
+	if (it.inputEmpty())
+	  ms.trans.push_back (MachineTransition (it.in, string(), inter2kept.at (ij2compState(it.dest,j,jStates)), it.weight));
+	else
+	  for (const auto jt: secondIndex.transitions (j, it.in))
+	    ms.trans.push_back (MachineTransition (it.in, string(), inter2kept.at (ij2compState(it.dest,jt->dest,jStates)), WeightAlgebra::multiply (it.weight, jt->weight)));
+    } else
+      for (const auto& jt: msj.trans)
+	ms.trans.push_back (MachineTransition (string(), string(), inter2kept.at (ij2compState(i,jt.dest,jStates)), jt.weight));
+  }
 
   LogThisAt(3,"Transducer intersection yielded " << interMachine.nStates() << "-state machine" << endl);
   return interMachine.ergodicMachine().advanceSort().advancingMachine().ergodicMachine();
@@ -579,6 +642,12 @@ Machine Machine::waitingMachine() const {
   return wm;
 }
 
+// States are processed in order. State s's silent transitions into earlier states j are replaced by effTrans[j], which is j's advancing transitions
+// with every silent transition into a state below s replaced, in place, by that state's advancing transitions (weights multiplied along the way);
+// silent self-loops are then factored out as geometric sums.
+// effTrans[j] is only brought up to date (from effThreshold[j] to s) when some state s reaches j by a silent transition,
+// rather than every earlier state being revisited for every s, and the substitution is done iteratively, in place.
+// The substitutions are the same, in the same order, so the weight expressions are identical to those of a full sweep
 Machine Machine::advancingMachine() const {
   Machine am;
   if (isAdvancingMachine()) {
@@ -587,55 +656,56 @@ Machine Machine::advancingMachine() const {
   } else {
     if (nStates()) {
       am.state.reserve (nStates());
-      vguard<TransList> effTrans;
-      vguard<StateIndex> minDest (nStates());
+      vguard<TransList> effTrans (nStates());
+      vguard<StateIndex> effThreshold (nStates()), minSilentDest (nStates());
+      // replaces silent transitions in effTrans[j] to states below s with those states' advancing transitions
+      auto updateEffTrans = [&] (StateIndex j, StateIndex s) {
+	if (minSilentDest[j] < s) {
+	  TransList& trans = effTrans[j];
+	  StateIndex newMinDest = nStates();
+	  for (auto iter = trans.begin(); iter != trans.end(); ) {
+	    if (iter->isSilent() && iter->dest < s) {
+	      const StateIndex k = iter->dest;
+	      Assert (k > j && k >= effThreshold[j], "oops: cycle. j=%d k=%d", j, k);
+	      TransList expansion;
+	      for (const auto& t_k: am.state[k].trans)
+		expansion.push_back (MachineTransition (t_k.in, t_k.out, t_k.dest, WeightAlgebra::multiply (iter->weight, t_k.weight)));
+	      iter = trans.erase (iter);
+	      if (!expansion.empty()) {
+		const auto first = expansion.begin();
+		trans.splice (iter, expansion);
+		iter = first;  // the substituted transitions may need substituting in turn
+	      }
+	    } else {
+	      if (iter->isSilent())
+		newMinDest = min (newMinDest, iter->dest);
+	      ++iter;
+	    }
+	  }
+	  minSilentDest[j] = newMinDest;
+	}
+	effThreshold[j] = s;
+      };
+      ProgressLog(plog,6);
+      plog.initProgress ("Converting %lu-state transducer into advancing machine", nStates());
       for (StateIndex s = 0; s < nStates(); ++s) {
+	plog.logProgress (s / (double) nStates(), "state %lu/%lu", s, nStates());
 	const MachineState& ms = state[s];
-	effTrans.push_back (ms.trans);
 	am.state.push_back (MachineState());
 	MachineState& ams = am.state.back();
 	ams.name = ms.name;
-	vguard<bool> markedForUpdate (s + 1, false);
-	function<void(StateIndex)> markForUpdate = [&](StateIndex i) {
-	  markedForUpdate[i] = true;
-	  if (minDest[i] < s)
-	    for (auto& t_ij: effTrans[i]) {
-	      Assert (t_ij.isLoud() || i == s || t_ij.dest > i, "oops: cycle. i=%d j=%d", i, t_ij.dest);
-	      if (t_ij.isSilent() && t_ij.dest < s && !markedForUpdate[t_ij.dest])
-		markForUpdate (t_ij.dest);
-	    }
-	};
-	markForUpdate(s);
-	function<void(StateIndex)> updateEffTrans = [&](StateIndex i) {
-	  TransList newEffTrans, elimTrans;
-	  StateIndex newMinDest = nStates();
-	  for (auto& t_ij: effTrans[i]) {
-	    if (t_ij.isLoud())
-	      newEffTrans.push_back(t_ij);
-	    else {
-	      const StateIndex j = t_ij.dest;
-	      if (j >= s) {
-		newMinDest = min (newMinDest, j);
-		newEffTrans.push_back(t_ij);
-	      } else
-		for (auto& t_jk: effTrans[j]) {
-		  const StateIndex k = t_jk.dest;
-		  Assert (t_jk.isLoud() || (k>j && (k > i || (k == i && i == s))), "oops: cycle. i=%d j=%d k=%d", i, j, k);
-		  newMinDest = min (newMinDest, k);
-		  newEffTrans.push_back (MachineTransition (t_jk.in, t_jk.out, k, WeightAlgebra::multiply (t_ij.weight, t_jk.weight)));
-		}
-	    }
-	  }
-	  minDest[i] = newMinDest;
-	  effTrans[i] = newEffTrans;
-	};
-	for (StateIndex t = s; t > 0; --t)
-	  updateEffTrans(t-1);
-	updateEffTrans(s);
 	// aggregate all transitions that go to the same place
 	TransAccumulator ta;
-	for (const auto& t: effTrans[s])
-	  ta.accumulate (t.in, t.out, t.dest, t.weight);
+	for (const auto& t_sj: ms.trans)
+	  if (t_sj.isSilent() && t_sj.dest < s) {
+	    const StateIndex j = t_sj.dest;
+	    updateEffTrans (j, s);
+	    for (const auto& t_jk: effTrans[j]) {
+	      Assert (t_jk.isLoud() || t_jk.dest >= s, "oops: cycle. i=%d j=%d k=%d", s, j, t_jk.dest);
+	      ta.accumulate (t_jk.in, t_jk.out, t_jk.dest, WeightAlgebra::multiply (t_sj.weight, t_jk.weight));
+	    }
+	  } else
+	    ta.accumulate (t_sj.in, t_sj.out, t_sj.dest, t_sj.weight);
 	const auto et = ta.transitions();
 	// factor out self-loops
 	WeightExpr exitSelf (true);
@@ -648,6 +718,11 @@ Machine Machine::advancingMachine() const {
 	  for (auto& t: ams.trans)
 	    t.weight = WeightAlgebra::multiply (exitSelf, t.weight);
 	effTrans[s] = ams.trans;
+	effThreshold[s] = s + 1;
+	minSilentDest[s] = nStates();
+	for (const auto& t: ams.trans)
+	  if (t.isSilent())
+	    minSilentDest[s] = min (minSilentDest[s], t.dest);
       }
       Assert (am.isAdvancingMachine(), "failed to create advancing machine");
       LogThisAt(5,"Converted " << nTransitions() << "-transition transducer into " << am.nTransitions() << "-transition advancing machine" << endl);
@@ -741,12 +816,10 @@ Machine Machine::advanceSort() const {
 bool Machine::isAligningMachine() const {
   for (StateIndex s = 0; s < nStates(); ++s) {
     const MachineState& ms = state[s];
-    map<StateIndex,map<InputSymbol,set<OutputSymbol> > > t;
-    for (const auto& trans: ms.trans) {
-      if (t[trans.dest][trans.in].count(trans.out))
+    set<tuple<StateIndex,SymbolId,SymbolId> > t;
+    for (const auto& trans: ms.trans)
+      if (!t.insert (make_tuple (trans.dest, trans.in.id(), trans.out.id())).second)
 	return false;
-      t[trans.dest][trans.in].insert(trans.out);
-    }
   }
   return true;
 }
@@ -798,6 +871,171 @@ Machine Machine::eliminateSilentTransitions() const {
   return elimMachine;
 }
 
+// Partial elimination: bypasses silent states (those whose outgoing transitions are all silent), other than the start & end states.
+// Each transition h->j into a bypassed state j is replaced by transitions h->k, one for each (silent) j->k, carrying the labels of h->j and the product of the weights,
+// so j's fanIn+fanOut transitions become (at most) fanIn*fanOut. A state is only bypassed if fanIn*fanOut <= maxGrowth*(fanIn+fanOut)
+// (so with maxGrowth=1, the number of transitions never goes up). States are considered from last to first, so chains of silent states can be bypassed in turn
+Machine Machine::eliminateSilentStates (double maxGrowth) const {
+  if (nStates() < 3)  // no states other than start & end
+    return *this;
+  if (!isAdvancingMachine())
+    return advancingMachine().eliminateSilentStates (maxGrowth);
+  LogThisAt(3,"Bypassing silent states of " << nStates() << "-state transducer, with transition growth of up to " << maxGrowth << " per state" << endl);
+  Machine em (*this);
+  vguard<set<StateIndex> > sources (nStates());
+  vguard<size_t> fanIn (nStates(), 0);
+  for (StateIndex s = 0; s < nStates(); ++s)
+    for (const auto& t: state[s].trans) {
+      sources[t.dest].insert (s);
+      ++fanIn[t.dest];
+    }
+  size_t nBypassed = 0;
+  for (StateIndex j = nStates() - 1; j > 1; --j) {
+    const StateIndex s = j - 1;
+    MachineState& ms = em.state[s];
+    if (ms.trans.empty() || !ms.isSilent() || sources[s].count(s))
+      continue;
+    const double in = fanIn[s], out = ms.trans.size();
+    if (in * out > maxGrowth * (in + out))
+      continue;
+    for (const StateIndex h: sources[s]) {
+      MachineState& msh = em.state[h];
+      TransAccumulator ta;
+      for (const auto& t_hs: msh.trans) {
+	--fanIn[t_hs.dest];
+	if (t_hs.dest == s)
+	  for (const auto& t_sk: ms.trans)
+	    ta.accumulate (t_hs.in, t_hs.out, t_sk.dest, WeightAlgebra::multiply (t_hs.weight, t_sk.weight));
+	else
+	  ta.accumulate (t_hs);
+      }
+      msh.trans = ta.transitions();
+      for (const auto& t: msh.trans) {
+	sources[t.dest].insert (h);
+	++fanIn[t.dest];
+      }
+    }
+    for (const auto& t_sk: ms.trans) {
+      sources[t_sk.dest].erase (s);
+      --fanIn[t_sk.dest];
+    }
+    sources[s].clear();
+    ms.trans.clear();
+    ++nBypassed;
+  }
+  const Machine elimMachine = em.ergodicMachine();
+  LogThisAt(3,"Bypassing " << nBypassed << " silent states of " << nStates() << "-state, " << nTransitions() << "-transition machine yielded " << elimMachine.nStates() << "-state, " << elimMachine.nTransitions() << "-transition machine" << endl);
+  return elimMachine;
+}
+
+Machine Machine::simplifyWeights() const {
+  Machine sm (*this);
+  size_t before = 0, after = 0;
+  for (auto& ms: sm.state)
+    for (auto& t: ms.trans) {
+      before += WeightAlgebra::nodeCount (t.weight);
+      t.weight = WeightAlgebra::simplify (t.weight);
+      after += WeightAlgebra::nodeCount (t.weight);
+    }
+  LogThisAt(3,"Simplifying transition weights reduced them from " << before << " to " << after << " expression nodes" << endl);
+  return sm;
+}
+
+// States are merged if they are bisimilar: they have the same transitions (labels and weight expressions) into the same classes of states.
+// The classes are found by partition refinement, starting from three (the start state, the end state and the rest),
+// and splitting each class by its states' transitions until no class splits. The start and end states are never merged.
+// A merged state's transitions into the same class are summed, so the machine stays aligning, and it keeps the name of its first state.
+// Silent transitions between classes can't form a cycle if the machine is advancing, so the classes are sorted (by first state, where possible) to keep it advancing
+Machine Machine::minimize() const {
+  LogThisAt(3,"Minimizing " << nStates() << "-state transducer" << endl);
+  map<string,size_t> weightId;
+  vguard<vguard<size_t> > transWeightId (nStates());
+  for (StateIndex s = 0; s < nStates(); ++s)
+    for (const auto& t: state[s].trans)
+      transWeightId[s].push_back (weightId.insert (make_pair (t.weight.dump(), weightId.size())).first->second);
+
+  // class IDs are numbered by first state, so class c's first state is never after class c+1's
+  vguard<StateIndex> cls (nStates());
+  for (StateIndex s = 0; s < nStates(); ++s)
+    cls[s] = s == startState() ? 0 : (s == endState() ? 2 : 1);
+  size_t nClasses = 0;
+  while (true) {
+    map<vguard<size_t>,StateIndex> sigCls;
+    vguard<StateIndex> newCls (nStates());
+    for (StateIndex s = 0; s < nStates(); ++s) {
+      vguard<tuple<SymbolId,SymbolId,StateIndex,size_t> > sigTrans;
+      size_t n = 0;
+      for (const auto& t: state[s].trans)
+	sigTrans.push_back (make_tuple (t.in.id(), t.out.id(), cls[t.dest], transWeightId[s][n++]));
+      sort (sigTrans.begin(), sigTrans.end());
+      vguard<size_t> sig (1, cls[s]);
+      for (const auto& st: sigTrans) {
+	sig.push_back (get<0>(st));
+	sig.push_back (get<1>(st));
+	sig.push_back (get<2>(st));
+	sig.push_back (get<3>(st));
+      }
+      newCls[s] = sigCls.insert (make_pair (sig, sigCls.size())).first->second;
+    }
+    cls.swap (newCls);
+    if (sigCls.size() == nClasses)
+      break;
+    nClasses = sigCls.size();
+  }
+  if (nClasses == nStates()) {
+    LogThisAt(3,"Transducer has no equivalent states" << endl);
+    return *this;
+  }
+
+  vguard<StateIndex> firstState (nClasses, nStates());
+  for (StateIndex s = nStates(); s > 0; --s)
+    firstState[cls[s-1]] = s - 1;
+  vguard<set<StateIndex> > silentDest (nClasses);
+  vguard<size_t> nSilentSources (nClasses, 0);
+  for (StateIndex c = 0; c < nClasses; ++c)
+    for (const auto& t: state[firstState[c]].trans)
+      if (t.isSilent() && cls[t.dest] != c && silentDest[c].insert (cls[t.dest]).second)
+	++nSilentSources[cls[t.dest]];
+  priority_queue<StateIndex,vguard<StateIndex>,greater<StateIndex> > ready;
+  for (StateIndex c = 0; c < nClasses; ++c)
+    if (!nSilentSources[c])
+      ready.push (c);
+  vguard<StateIndex> order;
+  vguard<bool> placed (nClasses, false);
+  while (!ready.empty()) {
+    const StateIndex c = ready.top();
+    ready.pop();
+    order.push_back (c);
+    placed[c] = true;
+    for (StateIndex d: silentDest[c])
+      if (--nSilentSources[d] == 0)
+	ready.push (d);
+  }
+  if (order.size() < nClasses) {
+    LogThisAt(1,"Warning: silent transitions between merged states form a cycle; the minimized machine is not advancing" << endl);
+    for (StateIndex c = 0; c < nClasses; ++c)
+      if (!placed[c])
+	order.push_back (c);
+  }
+  vguard<StateIndex> cls2new (nClasses);
+  for (StateIndex n = 0; n < nClasses; ++n)
+    cls2new[order[n]] = n;
+
+  Machine mm;
+  mm.state.resize (nClasses);
+  for (StateIndex c = 0; c < nClasses; ++c) {
+    const MachineState& ms = state[firstState[c]];
+    MachineState& mms = mm.state[cls2new[c]];
+    mms.name = ms.name;
+    TransAccumulator acc;
+    for (const auto& t: ms.trans)
+      acc.accumulate (t.in, t.out, cls2new[cls[t.dest]], t.weight);
+    mms.trans = acc.transitions();
+  }
+  LogThisAt(3,"Minimized transducer has " << mm.nStates() << " states" << endl);
+  return mm;
+}
+
 Machine Machine::generator (const string& name, const vguard<OutputSymbol>& seq) {
   Machine m;
   m.state.resize (seq.size() + 1);
@@ -959,6 +1197,21 @@ Machine Machine::singleTransition (const WeightExpr& weight) {
   return n;
 }
 
+MachineInputIndex::MachineInputIndex (const Machine& m)
+  : byInput (m.nStates())
+{
+  for (StateIndex s = 0; s < m.nStates(); ++s)
+    for (const auto& t: m.state[s].trans)
+      byInput[s][t.in.id()].push_back (&t);
+}
+
+const MachineInputIndex::TransPtrList& MachineInputIndex::transitions (StateIndex s, MachineSymbol in) const {
+  static const TransPtrList noTrans;
+  const auto& stateIndex = byInput[s];
+  const auto iter = stateIndex.find (in.id());
+  return iter == stateIndex.end() ? noTrans : iter->second;
+}
+
 TransAccumulator::TransAccumulator() : transList (NULL)
 { }
 
@@ -970,23 +1223,37 @@ void TransAccumulator::accumulate (const MachineTransition& t) {
   accumulate (t.in, t.out, t.dest, t.weight);
 }
 
-void TransAccumulator::accumulate (InputSymbol in, OutputSymbol out, StateIndex dest, WeightExpr w) {
+void TransAccumulator::accumulate (MachineSymbol in, MachineSymbol out, StateIndex dest, WeightExpr w) {
   if (transList)
     transList->push_back (MachineTransition (in, out, dest, w));
-  else {
-    if (t[dest][in].count(out))
-      t[dest][in][out] = WeightAlgebra::add(w,t[dest][in][out]);
-    else
-      t[dest][in][out] = w;
-  }
+  else
+    t.push_back (MachineTransition (in, out, dest, w));
 }
 
+// Each weight is added to the sum of those that arrived before it (w3 + (w2 + w1)), as they were when transitions were merged on arrival
 TransList TransAccumulator::transitions() const {
+  vguard<size_t> order (t.size());
+  for (size_t n = 0; n < order.size(); ++n)
+    order[n] = n;
+  auto sameKey = [&] (const MachineTransition& a, const MachineTransition& b) {
+    return a.dest == b.dest && a.in == b.in && a.out == b.out;
+  };
+  // labels compare as strings here, since this order is the order of the transitions in the machine
+  stable_sort (order.begin(), order.end(), [&] (size_t a, size_t b) {
+      const MachineTransition& ta = t[a];
+      const MachineTransition& tb = t[b];
+      return ta.dest != tb.dest ? ta.dest < tb.dest : (ta.in != tb.in ? ta.in < tb.in : ta.out < tb.out);
+    });
   TransList trans;
-  for (const auto& dest_map: t)
-    for (const auto& in_map: dest_map.second)
-      for (const auto& out_weight: in_map.second)
-	trans.push_back (MachineTransition (in_map.first, out_weight.first, dest_map.first, out_weight.second));
+  for (size_t n = 0; n < order.size(); ) {
+    const MachineTransition& first = t[order[n]];
+    WeightExpr w = first.weight;
+    size_t m = n + 1;
+    for (; m < order.size() && sameKey (t[order[m]], first); ++m)
+      w = WeightAlgebra::add (t[order[m]].weight, w);
+    trans.push_back (MachineTransition (first.in, first.out, first.dest, w));
+    n = m;
+  }
   return trans;
 }
 
@@ -999,8 +1266,8 @@ void MachinePath::writeJson (ostream& out) const {
     if (!t.inputEmpty())
       out << ",\"in\":\"" << t.in << "\"";
     if (!t.outputEmpty())
-      out << ",\"out\":\"" << t.out;
-    out << "\"}";
+      out << ",\"out\":\"" << t.out << "\"";
+    out << "}";
   }
   out << "]}";
 }
@@ -8,6 +8,7 @@
 #include "jsonio.h"
 #include "weight.h"
 #include "vguard.h"
+#include "symbol.h"
 
 using namespace std;
 using json = nlohmann::json;
@@ -21,13 +22,14 @@ typedef string OutputSymbol;
 typedef string InputSymbol;
 typedef json StateName;
 
+// Transition labels are interned (see symbol.h); InputSymbol & OutputSymbol strings convert to and from them implicitly
 struct MachineTransition {
-  InputSymbol in;
-  OutputSymbol out;
+  MachineSymbol in;
+  MachineSymbol out;
   StateIndex dest;
   WeightExpr weight;
   MachineTransition();
-  MachineTransition (InputSymbol, OutputSymbol, StateIndex, WeightExpr);
+  MachineTransition (MachineSymbol, MachineSymbol, StateIndex, WeightExpr);
   bool inputEmpty() const;
   bool outputEmpty() const;
   bool isSilent() const;  // inputEmpty() && outputEmpty()
@@ -78,7 +80,7 @@ struct Machine {
   static Machine null();
   static Machine singleTransition (const WeightExpr& weight);
 
-  static Machine compose (const Machine& first, const Machine& second, bool assignCompositeStateNames = true, bool collapseDegenerateTransitions = true);
+  static Machine compose (const Machine& first, const Machine& second, bool assignCompositeStateNames = true, bool collapseDegenerateTransitions = true, size_t threads = 1);
   static Machine intersect (const Machine& first, const Machine& second);
   static Machine concatenate (const Machine& left, const Machine& right);
   static Machine generator (const string& name, const vguard<OutputSymbol>& seq);
@@ -111,6 +113,9 @@ struct Machine {
   Machine advancingMachine() const;  // convert to advancing machine
 
   Machine eliminateSilentTransitions() const;
+  Machine eliminateSilentStates (double maxGrowth) const;  // bypass silent states, where that does not multiply their transitions by more than maxGrowth
+  Machine minimize() const;  // merge bisimilar states
+  Machine simplifyWeights() const;  // algebraically simplify every transition weight (see WeightAlgebra::simplify)
 
   size_t nSilentBackTransitions() const;
   Machine advanceSort() const;  // attempt to minimize number of silent i->j transitions where j<i
@@ -118,14 +123,25 @@ struct Machine {
 
 typedef JsonLoader<Machine> MachineLoader;
 
+// Merges parallel transitions (same destination & labels) by adding their weights.
+// Transitions are kept in a flat array, in arrival order, and merged when transitions() sorts them by destination, input & output
 struct TransAccumulator {
   TransList* transList;  // if non-null, will accumulate transitions direct to this list, without collapsing
-  map<StateIndex,map<InputSymbol,map<OutputSymbol,WeightExpr> > > t;
+  vguard<MachineTransition> t;
   TransAccumulator();
   void clear();
-  void accumulate (InputSymbol in, OutputSymbol out, StateIndex dest, WeightExpr w);
+  void accumulate (MachineSymbol in, MachineSymbol out, StateIndex dest, WeightExpr w);
   void accumulate (const MachineTransition&);
   TransList transitions() const;
 };
 
+// Each state's transitions, grouped by input symbol (in their original order), so that matching a symbol against a state's transitions costs only as much as the matches.
+// Since a Machine's transitions can be edited freely, the index is built by the operations that need it (it refers to the machine's transitions, so must not outlive them)
+struct MachineInputIndex {
+  typedef vguard<const MachineTransition*> TransPtrList;
+  vguard<map<SymbolId,TransPtrList> > byInput;
+  MachineInputIndex (const Machine&);
+  const TransPtrList& transitions (StateIndex s, MachineSymbol in) const;  // empty if s has no transitions with this input
+};
+
 #endif /* MACHINE_INCLUDED */
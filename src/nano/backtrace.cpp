@@ -1,44 +1,47 @@
 #include "../logger.h"
 #include "backtrace.h"
 
-BackwardTraceMatrix::BackwardTraceMatrix (ForwardTraceMatrix& fwd, MachineCounts* transCounts, vguard<GaussianCounts>* emitCounts) :
-  TraceDPMatrix (fwd.eval, fwd.modelParams, fwd.moments, fwd.traceParams, fwd.blockBytes, fwd.bandWidth),
-  nullTrans_rbegin (nullTrans.rbegin()),
-  nullTrans_rend (nullTrans.rend())
+template<class Cell>
+BackwardTraceMatrix<Cell>::BackwardTraceMatrix (ForwardTraceMatrix<Cell>& fwd, MachineCounts* transCounts, vguard<GaussianCounts>* emitCounts) :
+  TraceDPMatrix<Cell> (fwd.eval, fwd.modelParams, fwd.moments, fwd.traceParams, fwd.blockBytes, fwd.bandWidth),
+  nullTrans_rbegin (this->nullTrans.rbegin()),
+  nullTrans_rend (this->nullTrans.rend())
 {
   const double llFinal = fwd.logLike;
   Assert (llFinal > -numeric_limits<double>::infinity(), "Can't get Forward-Backward counts: Forward likelihood is zero");
 
+  // each column is accumulated in double, then stored
+  vguard<double> colLogLike (this->nStates);
+
   ProgressLog(plog,3);
-  plog.initProgress ("Backward algorithm (%ld samples, %u states, %u transitions)", outLen, nStates, nTrans);
+  plog.initProgress ("Backward algorithm (%ld samples, %u states, %u transitions)", this->outLen, this->nStates, this->nTrans);
 
-  for (OutputIndex outPos = outLen; outPos >= 0; --outPos) {
-    plog.logProgress ((outLen - outPos) / (double) outLen, "sample %ld/%ld", outPos, outLen);
+  for (OutputIndex outPos = this->outLen; outPos >= 0; --outPos) {
+    plog.logProgress ((this->outLen - outPos) / (double) this->outLen, "sample %ld/%ld", outPos, this->outLen);
 
-    vguard<double>& thisColumn = column(outPos);
-    initColumn (thisColumn);
+    fill (colLogLike.begin(), colLogLike.end(), -numeric_limits<double>::infinity());
 
     fwd.readyColumn(outPos);
-    const vguard<double>& thisFwdColumn = fwd.column(outPos);
+    const vguard<Cell>& thisFwdColumn = fwd.column(outPos);
 
-    if (outPos == outLen)
-      thisColumn[eval.endState()] = 0;
+    if (outPos == this->outLen)
+      colLogLike[this->eval.endState()] = 0;
     else {
-      const auto& sample = moments.sample[outPos];
-      const vguard<double>& nextColumn = column(outPos+1);
-      const auto itBegin = bandTransBegin(outPos), itEnd = bandTransEnd(outPos);
+      const auto& sample = this->moments.sample[outPos];
+      const vguard<Cell>& nextColumn = this->column(outPos+1);
+      const auto itBegin = this->bandTransBegin(outPos), itEnd = this->bandTransEnd(outPos);
       for (auto itIter = itBegin; itIter != itEnd; ++itIter) {
 	const auto& it = *itIter;
 	const OutputToken outTok = it.out;
-	const double llEmit = logEmitProb(outPos+1,outTok);
-	const double llTrans = nextColumn[it.dest] + logTransProb(outPos+1,it) + llEmit;
-	log_accum_exp (thisColumn[it.src], llTrans);
+	const double llEmit = this->logEmitProb(outPos+1,outTok);
+	const double llTrans = nextColumn[it.dest] + this->logTransProb(outPos+1,it) + llEmit;
+	log_accum_exp (colLogLike[it.src], llTrans);
 	if (transCounts || emitCounts) {
 	  const double ppEmit = exp (thisFwdColumn[it.src] + llTrans - llFinal);
 	  if (transCounts) {
 	    transCounts->count[it.src][it.transIndex] += ppEmit;
 	    if (it.loop) {
-	      const auto& mom = moments.sample[outPos];
+	      const auto& mom = this->moments.sample[outPos];
 	      transCounts->count[it.dest][it.loopTransIndex] += (mom.m0 - 1) * ppEmit;
 	    }
 	  }
@@ -49,16 +52,23 @@ BackwardTraceMatrix::BackwardTraceMatrix (ForwardTraceMatrix& fwd, MachineCounts
     }
 
     for (auto iter = nullTrans_rbegin; iter != nullTrans_rend; ++iter) {
-      const double llTrans = thisColumn[(*iter).dest] + (*iter).logWeight;
-      log_accum_exp (thisColumn[(*iter).src], llTrans);
+      const double llTrans = colLogLike[(*iter).dest] + (*iter).logWeight;
+      log_accum_exp (colLogLike[(*iter).src], llTrans);
       if (transCounts)
 	transCounts->count[(*iter).src][(*iter).transIndex] += exp (thisFwdColumn[(*iter).src] + llTrans - llFinal);
     }
+
+    vguard<Cell>& thisColumn = this->column(outPos);
+    copy (colLogLike.begin(), colLogLike.end(), thisColumn.begin());
   }
   LogThisAt(6,"Backward log-likelihood: " << logLike() << endl);
   LogThisAt(10,"Backward matrix:" << endl << *this);
 }
 
-double BackwardTraceMatrix::logLike() const {
-  return cell (0, eval.startState());
+template<class Cell>
+double BackwardTraceMatrix<Cell>::logLike() const {
+  return this->cell (0, this->eval.startState());
 }
+
+template class BackwardTraceMatrix<float>;
+template class BackwardTraceMatrix<double>;
@@ -4,11 +4,17 @@
 #include "fwdtrace.h"
 #include "gcounts.h"
 
-class BackwardTraceMatrix : public TraceDPMatrix {
+template<class Cell>
+class BackwardTraceMatrix : public TraceDPMatrix<Cell> {
+public:
+  typedef typename TraceDPMatrix<Cell>::OutputIndex OutputIndex;
+  typedef typename TraceDPMatrix<Cell>::IndexedTrans IndexedTrans;
+
 private:
-  vguard<IndexedTrans>::const_reverse_iterator nullTrans_rbegin, nullTrans_rend;
+  typename vguard<IndexedTrans>::const_reverse_iterator nullTrans_rbegin, nullTrans_rend;
+
 public:
-  BackwardTraceMatrix (ForwardTraceMatrix&, MachineCounts* = NULL, vguard<GaussianCounts>* = NULL);
+  BackwardTraceMatrix (ForwardTraceMatrix<Cell>&, MachineCounts* = NULL, vguard<GaussianCounts>* = NULL);
   double logLike() const;
 };
 
@@ -1,7 +1,8 @@
 #include "dptrace.h"
 #include "../logger.h"
 
-TraceDPMatrix::IndexedTrans::IndexedTrans (const EvaluatedMachineState::Trans& t, StateIndex s, StateIndex d, InputToken i, OutputToken o) :
+template<class Cell>
+TraceDPMatrix<Cell>::IndexedTrans::IndexedTrans (const EvaluatedMachineState::Trans& t, StateIndex s, StateIndex d, InputToken i, OutputToken o) :
   loopLogWeight (-numeric_limits<double>::infinity()),
   loopTransIndex (0),
   loop (false)
@@ -13,20 +14,8 @@ TraceDPMatrix::IndexedTrans::IndexedTrans (const EvaluatedMachineState::Trans& t
   out = o;
 }
 
-// S = storageColumns, M = maxStorageColumns, T = totalColumns, X = blockSize
-// X + (T/X) = S
-// If M is large enough, we can set S=M so that all available storage is used:
-//  X + (T/X) = M
-//  X^2 - MX + T = 0
-//  X = (M + sqrt(M^2 - 4T)) / 2
-// The condition for this is M^2 - 4T >= 0
-// Otherwise, we just minimize S via dS/dX=0, yielding X=sqrt(T) and S=2*sqrt(T)
-size_t calcBlockSize (size_t maxStorageColumns, size_t totalColumns) {
-  const double discriminant = pow ((double) maxStorageColumns, 2) - 4 * (double) totalColumns;
-  return ceil (discriminant >= 0 ? ((maxStorageColumns + sqrt(discriminant)) / 2) : sqrt ((double) totalColumns));
-}
-
-TraceDPMatrix::TraceDPMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& moments, const TraceParams& traceParams, size_t bb, double bandWidth) :
+template<class Cell>
+TraceDPMatrix<Cell>::TraceDPMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& moments, const TraceParams& traceParams, size_t bb, double bandWidth) :
   eval (eval),
   modelParams (modelParams),
   moments (moments),
@@ -40,7 +29,7 @@ TraceDPMatrix::TraceDPMatrix (const EvaluatedMachine& eval, const GaussianModelP
   blockSize (blockBytes
 	     ? max ((OutputIndex) 2,
 		    min ((OutputIndex) nColumns,
-			 (OutputIndex) calcBlockSize (blockBytes / (nStates * sizeof(double)), outLen)))
+			 (OutputIndex) calcBlockSize (blockBytes / (nStates * sizeof(Cell)), outLen)))
 	     : nColumns),
   nCheckpoints (1 + ((nColumns - 1) / blockSize)),
   bandWidth (bandWidth),
@@ -108,10 +97,11 @@ TraceDPMatrix::TraceDPMatrix (const EvaluatedMachine& eval, const GaussianModelP
   const OutputIndex storageColumns = blockSize + nCheckpoints - 1;
   LogThisAt(8,"Block size is " << blockSize << " columns, # of checkpoint columns is " << nCheckpoints << endl);
   LogThisAt(7,"Creating " << storageColumns << "-column * " << nStates << "-state matrix" << endl);
-  columnStorage.resize (storageColumns, vguard<double> (nStates, -numeric_limits<double>::infinity()));
+  columnStorage.resize (storageColumns, vguard<Cell> (nStates, -numeric_limits<Cell>::infinity()));
 }
 
-void TraceDPMatrix::writeJson (ostream& out) {
+template<class Cell>
+void TraceDPMatrix<Cell>::writeJson (ostream& out) {
   out << "{" << endl
        << " \"cell\": [";
   for (OutputIndex o = 0; o <= outLen; ++o)
@@ -123,7 +113,5 @@ void TraceDPMatrix::writeJson (ostream& out) {
       << "}" << endl;
 }
 
-ostream& operator<< (ostream& out, TraceDPMatrix& m) {
-  m.writeJson (out);
-  return out;
-}
+template class TraceDPMatrix<float>;
+template class TraceDPMatrix<double>;
@@ -5,6 +5,8 @@
 #include "../logsumexp.h"
 #include "moments.h"
 
+// As with DPMatrix, columns are stored as Cell (float or double), but the recursions are evaluated in double
+template<class Cell>
 class TraceDPMatrix {
 public:
   typedef long OutputIndex;
@@ -23,7 +25,7 @@ private:
   typedef long long CellIndex;
   typedef long long EmitIndex;
 
-  vguard<vguard<double> > columnStorage;
+  vguard<vguard<Cell> > columnStorage;
 
   inline size_t columnIndex (OutputIndex outPos) const {
     const long blockOffset = outPos % blockSize;
@@ -35,8 +37,30 @@ protected:
   size_t nTrans, maxDistanceFromStart;
   vguard<size_t> emitTransOffset;   // if idx = emitTransOffset[d], then emitTrans[idx] is first emit transition to a state of distance >= d from start
   
-  void initColumn (vguard<double>& col) {
-    fill (col.begin(), col.end(), -numeric_limits<double>::infinity());
+  void initColumn (vguard<Cell>& col) {
+    fill (col.begin(), col.end(), -numeric_limits<Cell>::infinity());
+  }
+
+  // Accumulates term(trans) into col[trans.dest] for each transition from begin to end, which must be grouped by destination
+  // (as emitTrans and nullTrans are). The terms for each destination are gathered and summed in batches by log_sum_exp
+  template<class Term>
+  static void accumulateByDest (vguard<Cell>& col, typename vguard<IndexedTrans>::const_iterator begin, typename vguard<IndexedTrans>::const_iterator end, Term term) {
+    double batch[LOG_SUM_EXP_BATCH_SIZE];
+    for (auto iter = begin; iter != end; ) {
+      const StateIndex dest = (*iter).dest;
+      double ll = col[dest];
+      size_t n = 0;
+      for (; iter != end && (*iter).dest == dest; ++iter) {
+	batch[n++] = term (*iter);
+	if (n == LOG_SUM_EXP_BATCH_SIZE) {
+	  log_accum_exp (ll, log_sum_exp (batch, n));
+	  n = 0;
+	}
+      }
+      if (n)
+	log_accum_exp (ll, log_sum_exp (batch, n));
+      col[dest] = ll;
+    }
   }
 
   inline OutputIndex checkpoint (OutputIndex outPos) const {
@@ -47,12 +71,12 @@ protected:
     return max (halfBandWidth, min (1. - halfBandWidth, outPos / (double) outLen));
   }
   
-  inline vguard<IndexedTrans>::const_iterator bandTransBegin (OutputIndex outPos) const {
+  inline typename vguard<IndexedTrans>::const_iterator bandTransBegin (OutputIndex outPos) const {
     const size_t d = (size_t) (maxDistanceFromStart * max (0., fracBandCenter(outPos) - halfBandWidth));
     return emitTrans.begin() + emitTransOffset[d];
   }
 
-  inline vguard<IndexedTrans>::const_iterator bandTransEnd (OutputIndex outPos) const {
+  inline typename vguard<IndexedTrans>::const_iterator bandTransEnd (OutputIndex outPos) const {
     const size_t d = (size_t) (maxDistanceFromStart * min (1., fracBandCenter(outPos) + halfBandWidth));
     return emitTrans.begin() + emitTransOffset[d+1];
   }
@@ -75,10 +99,10 @@ public:
   
   TraceDPMatrix (const EvaluatedMachine&, const GaussianModelParams&, const TraceMoments&, const TraceParams&, size_t blockBytes = 0, double bandWidth = 1);
 
-  inline vguard<double>& column (OutputIndex outPos) { return columnStorage[columnIndex(outPos)]; }
-  inline const vguard<double>& column (OutputIndex outPos) const { return columnStorage[columnIndex(outPos)]; }
+  inline vguard<Cell>& column (OutputIndex outPos) { return columnStorage[columnIndex(outPos)]; }
+  inline const vguard<Cell>& column (OutputIndex outPos) const { return columnStorage[columnIndex(outPos)]; }
   
-  inline double& cell (OutputIndex outPos, StateIndex state) { return column(outPos)[state]; }
+  inline Cell& cell (OutputIndex outPos, StateIndex state) { return column(outPos)[state]; }
   inline const double cell (OutputIndex outPos, StateIndex state) const { return column(outPos)[state]; }
 
   inline double logEmitProb (OutputIndex outPos, OutputToken outTok) const {
@@ -113,7 +137,12 @@ public:
   }
 
   void writeJson (ostream&);
-  friend ostream& operator<< (ostream&, TraceDPMatrix&);
 };
 
+template<class Cell>
+ostream& operator<< (ostream& out, TraceDPMatrix<Cell>& m) {
+  m.writeJson (out);
+  return out;
+}
+
 #endif /* DPTRACE_INCLUDED */
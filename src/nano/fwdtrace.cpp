@@ -1,52 +1,271 @@
+#include <float.h>
 #include "fwdtrace.h"
 #include "../logger.h"
 
-ForwardTraceMatrix::ForwardTraceMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& trace, const TraceParams& traceParams, size_t blockBytes, double bandWidth) :
-  TraceDPMatrix (eval, modelParams, trace, traceParams, blockBytes, bandWidth)
+template<class Cell>
+ForwardTraceMatrix<Cell>::ForwardTraceMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& trace, const TraceParams& traceParams, size_t blockBytes, double bandWidth) :
+  ForwardTraceMatrix (eval, modelParams, trace, traceParams, blockBytes, bandWidth, true)
+{ }
+
+template<class Cell>
+ForwardTraceMatrix<Cell>::ForwardTraceMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& trace, const TraceParams& traceParams, size_t blockBytes, double bandWidth, bool scaled) :
+  TraceDPMatrix<Cell> (eval, modelParams, trace, traceParams, blockBytes, bandWidth),
+  scaledColumns (scaled),
+  colProbPos (-1),
+  logColumnsLeft (0)
 {
+  compileTrans (this->emitTrans, true, emitMatrix);
+  compileTrans (this->nullTrans, false, nullMatrix);
+  LogThisAt(7,"Compiled transitions to " << emitMatrix.rowDest.size() << " emit rows and " << nullMatrix.rowDest.size() << " null rows" << (scaledColumns ? "" : "; some weights are too small for probability space") << endl);
+
   ProgressLog(plog,3);
-  plog.initProgress ("Forward algorithm (%ld samples, %u states, %u transitions)", outLen, nStates, nTrans);
+  plog.initProgress ("Forward algorithm (%ld samples, %u states, %u transitions)", this->outLen, this->nStates, this->nTrans);
 
-  cell(0,eval.startState()) = 0;
-  for (const auto& it: nullTrans)
-    log_accum_exp (cell(0,it.dest), cell(0,it.src) + it.logWeight);
+  this->cell(0,this->eval.startState()) = 0;
+  vguard<Cell>& firstColumn = this->column(0);
+  this->accumulateByDest (firstColumn, this->nullTrans.begin(), this->nullTrans.end(), [&] (const IndexedTrans& it) {
+      return firstColumn[it.src] + it.logWeight;
+    });
 
-  for (OutputIndex outPos = 1; outPos <= outLen; ++outPos) {
-    plog.logProgress ((outPos - 1) / (double) outLen, "sample %ld/%ld", outPos, outLen);
+  for (OutputIndex outPos = 1; outPos <= this->outLen; ++outPos) {
+    plog.logProgress ((outPos - 1) / (double) this->outLen, "sample %ld/%ld", outPos, this->outLen);
     fillColumn (outPos);
   }
 
-  logLike = cell (outLen, eval.endState());
+  logLike = this->cell (this->outLen, this->eval.endState());
   LogThisAt(6,"Forward log-likelihood: " << logLike << endl);
   LogThisAt(10,"Forward matrix:" << endl << *this);
 }
 
-void ForwardTraceMatrix::fillColumn (OutputIndex outPos) {
-  vguard<double>& thisColumn = column(outPos);
-  initColumn (thisColumn);
+// A product of a normal probability and a weight of at least DBL_EPSILON cannot round to zero,
+// so in fillColumnScaled a row with any nonzero source has a nonzero sum, and a sum too small to be accurate can be detected and redone in log space
+template<class Cell>
+void ForwardTraceMatrix<Cell>::compileTrans (const vguard<IndexedTrans>& trans, bool emit, SparseTransMatrix& matrix) {
+  for (size_t n = 0; n < trans.size(); ++n) {
+    const IndexedTrans& it = trans[n];
+    if (n == 0 || it.dest != trans[n-1].dest || (emit && (it.out != trans[n-1].out || it.loopLogWeight != trans[n-1].loopLogWeight))) {
+      matrix.rowOffset.push_back (n);
+      matrix.rowDest.push_back (it.dest);
+      if (emit) {
+	emitRowOut.push_back (it.out);
+	emitRowLoopLogWeight.push_back (it.loopLogWeight);
+      }
+    }
+    matrix.src.push_back (it.src);
+    matrix.logWeight.push_back (it.logWeight);
+    matrix.weight.push_back (exp (it.logWeight));
+    if (matrix.weight.back() > 0 && matrix.weight.back() < DBL_EPSILON)
+      scaledColumns = false;
+  }
+  matrix.rowOffset.push_back (trans.size());
+}
+
+// In fillColumnScaled, a cell is prob * exp(logScale) + exp(lostLogLike), where prob is zero or a normal double, and lostLogLike is any part too small to be held in prob.
+// absorbLost folds the lost part into prob where it can: if it is in range, or if it is below prob's rounding error
+static inline void absorbLost (double& prob, double& lostLogLike, double logScale) {
+  const double relLogLike = lostLogLike - logScale;
+  if (relLogLike > log (DBL_MIN) + 1) {
+    prob += exp (relLogLike);
+    lostLogLike = -numeric_limits<double>::infinity();
+  } else if (prob >= 8 * DBL_MIN / DBL_EPSILON)
+    lostLogLike = -numeric_limits<double>::infinity();
+}
+
+// Probability-space column update: sparse matrix-vector products, with one exp per emit row and one log per state, instead of a log_sum_exp term per transition.
+// A column's dynamic range can exceed that of a double (states that are dying out fall thousands of nats below the best), so cells that would underflow are held as log-likelihoods,
+// and the transitions out of them are summed in log space. Sums of probabilities small enough to have lost precision to subnormal products are also redone in log space,
+// so every cell gets the same value as in the log-space update, up to rounding.
+// The previous column is taken from colProb if it was just filled (and is not a checkpoint, which a refill would start from), otherwise from its stored log-likelihoods.
+// Each emit row's sum is scaled by its emission factor relative to the largest (roughly, by binary exponent) over the band, and the column is rescaled by a power of two once filled
+template<class Cell>
+bool ForwardTraceMatrix<Cell>::fillColumnScaled (OutputIndex outPos) {
+  const double minusInf = -numeric_limits<double>::infinity(), minAccurate = DBL_MIN / DBL_EPSILON;
+  const StateIndex nStates = this->nStates;
+  const OutputIndex prevPos = outPos - 1;
+  double prevLogScale;
+  if (colProbPos == prevPos && this->checkpoint(prevPos) != prevPos) {
+    prevProb.swap (colProb);
+    prevLostLogLike.swap (colLostLogLike);
+    prevLogScale = colLogScale;
+  } else {
+    const vguard<Cell>& prevColumn = this->column(prevPos);
+    prevLogScale = *max_element (prevColumn.begin(), prevColumn.end());
+    if (!(prevLogScale > minusInf && prevLogScale < numeric_limits<double>::infinity()))
+      return false;
+    prevProb.resize (nStates);
+    prevLostLogLike.resize (nStates);
+    for (StateIndex s = 0; s < nStates; ++s) {
+      prevProb[s] = 0;
+      prevLostLogLike[s] = prevColumn[s];
+      absorbLost (prevProb[s], prevLostLogLike[s], prevLogScale);
+    }
+  }
+  colProbPos = -1;
+
+  const size_t rowBegin = upper_bound (emitMatrix.rowOffset.begin(), emitMatrix.rowOffset.end(), this->bandTransBegin(outPos) - this->emitTrans.begin()) - emitMatrix.rowOffset.begin() - 1;
+  const size_t rowEnd = upper_bound (emitMatrix.rowOffset.begin(), emitMatrix.rowOffset.end(), this->bandTransEnd(outPos) - this->emitTrans.begin()) - emitMatrix.rowOffset.begin() - 1;
+  rowSum.resize (emitMatrix.rowDest.size());
+  rowLogFactor.resize (emitMatrix.rowDest.size());
+  rowLost.resize (emitMatrix.rowDest.size());
+  double maxLogFactor = minusInf;
+  for (size_t r = rowBegin; r < rowEnd; ++r) {
+    double sum = 0;
+    bool lost = false;
+    for (size_t k = emitMatrix.rowOffset[r]; k < emitMatrix.rowOffset[r+1]; ++k) {
+      const StateIndex src = emitMatrix.src[k];
+      sum += prevProb[src] * emitMatrix.weight[k];
+      lost = lost || prevLostLogLike[src] > minusInf;
+    }
+    rowSum[r] = sum;
+    rowLost[r] = lost;
+    if (sum > 0 || lost)
+      rowLogFactor[r] = this->logTransProb (outPos, 0., emitRowLoopLogWeight[r]) + this->logEmitProb (outPos, emitRowOut[r]);
+    if (sum > 0) {
+      int exponent;
+      (void) frexp (sum, &exponent);
+      maxLogFactor = max (maxLogFactor, rowLogFactor[r] + exponent * M_LN2);
+    }
+  }
+  if (!(maxLogFactor > minusInf && maxLogFactor < numeric_limits<double>::infinity()))
+    return false;
+
+  // until the column is rescaled, colProb is relative to exp(emitLogScale)
+  const double emitLogScale = prevLogScale + maxLogFactor;
+  colProb.resize (nStates);
+  colLostLogLike.resize (nStates);
+  fill (colProb.begin(), colProb.end(), 0.);
+  fill (colLostLogLike.begin(), colLostLogLike.end(), minusInf);
+  lostDest.clear();
+  for (size_t r = rowBegin; r < rowEnd; ++r)
+    if (rowSum[r] > 0 || rowLost[r]) {
+      const StateIndex dest = emitMatrix.rowDest[r];
+      const double sum = rowSum[r], factor = exp (rowLogFactor[r] - maxLogFactor), p = sum * factor;
+      if (sum >= minAccurate && factor >= DBL_MIN && p >= DBL_MIN)
+	colProb[dest] += p;
+      else if (sum > 0) {
+	double ll = minusInf;
+	for (size_t k = emitMatrix.rowOffset[r]; k < emitMatrix.rowOffset[r+1]; ++k) {
+	  const StateIndex src = emitMatrix.src[k];
+	  if (prevProb[src] > 0)
+	    log_accum_exp (ll, log (prevProb[src]) + emitMatrix.logWeight[k]);
+	}
+	log_accum_exp (colLostLogLike[dest], ll + prevLogScale + rowLogFactor[r]);
+	lostDest.push_back (dest);
+      }
+      if (rowLost[r]) {
+	double ll = minusInf;
+	for (size_t k = emitMatrix.rowOffset[r]; k < emitMatrix.rowOffset[r+1]; ++k) {
+	  const StateIndex src = emitMatrix.src[k];
+	  if (prevLostLogLike[src] > minusInf)
+	    log_accum_exp (ll, prevLostLogLike[src] + emitMatrix.logWeight[k]);
+	}
+	log_accum_exp (colLostLogLike[dest], ll + rowLogFactor[r]);
+	lostDest.push_back (dest);
+      }
+    }
+  for (StateIndex dest: lostDest)
+    absorbLost (colProb[dest], colLostLogLike[dest], emitLogScale);
+
+  // null rows are sorted by destination, and go from lower to higher states, so their sources are finished
+  for (size_t r = 0; r + 1 < nullMatrix.rowOffset.size(); ++r) {
+    const StateIndex dest = nullMatrix.rowDest[r];
+    double p = colProb[dest], lostLogLike = colLostLogLike[dest];
+    bool lost = false;
+    for (size_t k = nullMatrix.rowOffset[r]; k < nullMatrix.rowOffset[r+1]; ++k) {
+      const StateIndex src = nullMatrix.src[k];
+      p += colProb[src] * nullMatrix.weight[k];
+      lost = lost || colLostLogLike[src] > minusInf;
+    }
+    if (lost)
+      for (size_t k = nullMatrix.rowOffset[r]; k < nullMatrix.rowOffset[r+1]; ++k) {
+	const StateIndex src = nullMatrix.src[k];
+	if (colLostLogLike[src] > minusInf)
+	  log_accum_exp (lostLogLike, colLostLogLike[src] + nullMatrix.logWeight[k]);
+      }
+    if (p > 0 && p < minAccurate) {
+      double ll = colProb[dest] > 0 ? log (colProb[dest]) : minusInf;
+      for (size_t k = nullMatrix.rowOffset[r]; k < nullMatrix.rowOffset[r+1]; ++k) {
+	const StateIndex src = nullMatrix.src[k];
+	if (colProb[src] > 0)
+	  log_accum_exp (ll, log (colProb[src]) + nullMatrix.logWeight[k]);
+      }
+      log_accum_exp (lostLogLike, ll + emitLogScale);
+      p = 0;
+    }
+    colProb[dest] = p;
+    colLostLogLike[dest] = lostLogLike;
+    if (lostLogLike > minusInf)
+      absorbLost (colProb[dest], colLostLogLike[dest], emitLogScale);
+  }
+
+  const double colMax = *max_element (colProb.begin(), colProb.end());
+  if (!(colMax <= DBL_MAX))
+    return false;
+  int exponent = 0;
+  if (colMax > 0)
+    (void) frexp (colMax, &exponent);
+  const double scale = ldexp (1., -exponent);
+  colLogScale = emitLogScale + exponent * M_LN2;
+  vguard<Cell>& thisColumn = this->column(outPos);
+  StateIndex nLost = 0;
+  for (StateIndex s = 0; s < nStates; ++s) {
+    double& p = colProb[s];
+    double& lostLogLike = colLostLogLike[s];
+    if (p > 0) {
+      if (p * scale < DBL_MIN) {
+	log_accum_exp (lostLogLike, log (p) + emitLogScale);
+	p = 0;
+      } else
+	p *= scale;
+    }
+    if (lostLogLike > minusInf) {
+      absorbLost (p, lostLogLike, colLogScale);
+      nLost += lostLogLike > minusInf;
+      thisColumn[s] = p > 0 ? log_sum_exp (log (p) + colLogScale, lostLogLike) : lostLogLike;
+    } else
+      thisColumn[s] = log (p) + colLogScale;
+  }
+  colProbPos = outPos;
+  // once many cells are out of range, the log-space sums cost more than the probability-space ones save, so back off for a while
+  if (nLost > nStates / 8)
+    logColumnsLeft = 64;
+  return true;
+}
+
+template<class Cell>
+void ForwardTraceMatrix<Cell>::fillColumn (OutputIndex outPos) {
+  if (outPos > 0 && scaledColumns) {
+    if (logColumnsLeft > 0)
+      --logColumnsLeft;
+    else if (fillColumnScaled (outPos)) {
+      lastCheckpoint = this->checkpoint(outPos);
+      return;
+    }
+  }
+  vguard<Cell>& thisColumn = this->column(outPos);
+  this->initColumn (thisColumn);
   if (outPos == 0)
-    thisColumn[eval.startState()] = 0;
+    thisColumn[this->eval.startState()] = 0;
   else {
-    const vguard<double>& prevColumn = column(outPos-1);
-    const auto itBegin = bandTransBegin(outPos), itEnd = bandTransEnd(outPos);
-    for (auto itIter = itBegin; itIter != itEnd; ++itIter) {
-      const auto& it = *itIter;
-      const OutputToken outTok = it.out;
-      const double llEmit = logEmitProb(outPos,outTok);
-      log_accum_exp (thisColumn[it.dest], prevColumn[it.src] + logTransProb(outPos,it) + llEmit);
-    }
+    const vguard<Cell>& prevColumn = this->column(outPos-1);
+    this->accumulateByDest (thisColumn, this->bandTransBegin(outPos), this->bandTransEnd(outPos), [&] (const IndexedTrans& it) {
+	return prevColumn[it.src] + this->logTransProb(outPos,it) + this->logEmitProb(outPos,it.out);
+      });
   }
 
-  for (const auto& it: nullTrans)
-    log_accum_exp (thisColumn[it.dest], thisColumn[it.src] + it.logWeight);
+  // null transitions are sorted by destination, and go from lower to higher states, so their sources are finished
+  this->accumulateByDest (thisColumn, this->nullTrans.begin(), this->nullTrans.end(), [&] (const IndexedTrans& it) {
+      return thisColumn[it.src] + it.logWeight;
+    });
 
-  lastCheckpoint = checkpoint(outPos);
+  lastCheckpoint = this->checkpoint(outPos);
 }
 
-void ForwardTraceMatrix::readyColumn (OutputIndex outPos) {
-  const OutputIndex blockStart = checkpoint(outPos);
+template<class Cell>
+void ForwardTraceMatrix<Cell>::readyColumn (OutputIndex outPos) {
+  const OutputIndex blockStart = this->checkpoint(outPos);
   if (blockStart != lastCheckpoint) {
-    const OutputIndex blockEnd = min((OutputIndex)nColumns,blockStart+blockSize) - 1;
+    const OutputIndex blockEnd = min((OutputIndex)this->nColumns,blockStart+this->blockSize) - 1;
     LogThisAt(4,"Refilling Forward matrix from sample " << (blockStart+1) << " to " << blockEnd << endl);
 
     for (OutputIndex outPos = blockStart + 1; outPos <= blockEnd; ++outPos)
@@ -54,14 +273,15 @@ void ForwardTraceMatrix::readyColumn (OutputIndex outPos) {
   }
 }
 
-MachinePath ForwardTraceMatrix::samplePath (const Machine& machine, mt19937& generator) {
+template<class Cell>
+MachinePath ForwardTraceMatrix<Cell>::samplePath (const Machine& machine, mt19937& generator) {
   Assert (logLike > -numeric_limits<double>::infinity(), "Can't sample Forward traceback: no finite-weight paths");
   uniform_real_distribution<double> distrib;
   MachinePath path;
-  OutputIndex outPos = outLen;
-  StateIndex s = nStates - 1;
+  OutputIndex outPos = this->outLen;
+  StateIndex s = this->nStates - 1;
   while (outPos > 0 || s != 0) {
-    const EvaluatedMachineState& state = eval.state[s];
+    const EvaluatedMachineState& state = this->eval.state[s];
     vguard<double> transLogLike;
     vguard<EvaluatedMachineState::TransIndex> transIndex;
     vguard<StateIndex> transSource;
@@ -72,7 +292,7 @@ MachinePath ForwardTraceMatrix::samplePath (const Machine& machine, mt19937& gen
 	const OutputToken outTok = outTok_stateTransMap.first;
 	if (outTok == 0 || outPos > 0)
 	  for (const auto& src_trans: outTok_stateTransMap.second) {
-	    const double tll = logIncomingProb (inTok, outTok, outPos, src_trans.first, s, src_trans.second);
+	    const double tll = this->logIncomingProb (inTok, outTok, outPos, src_trans.first, s, src_trans.second);
 	    transLogLike.push_back (tll);
 	    transIndex.push_back (src_trans.second.transIndex);
 	    transSource.push_back (src_trans.first);
@@ -97,3 +317,6 @@ MachinePath ForwardTraceMatrix::samplePath (const Machine& machine, mt19937& gen
   }
   return path;
 }
+
+template class ForwardTraceMatrix<float>;
+template class ForwardTraceMatrix<double>;
@@ -4,11 +4,46 @@
 #include <random>
 #include "dptrace.h"
 
-class ForwardTraceMatrix : public TraceDPMatrix {
+template<class Cell>
+class ForwardTraceMatrix : public TraceDPMatrix<Cell> {
+public:
+  typedef typename TraceDPMatrix<Cell>::OutputIndex OutputIndex;
+  typedef typename TraceDPMatrix<Cell>::IndexedTrans IndexedTrans;
+
 private:
+  // A set of transitions compiled to a sparse (CSR) matrix in probability space.
+  // Row r holds entries rowOffset[r]..rowOffset[r+1]-1, each a source state and a weight (also kept as a log-weight), and adds into state rowDest[r]
+  struct SparseTransMatrix {
+    vguard<size_t> rowOffset;
+    vguard<StateIndex> rowDest, src;
+    vguard<double> weight, logWeight;
+  };
+
+  // Emit rows share a destination, output token and loop weight (so one emission factor scales the whole row), and their entries are the emitTrans in order,
+  // so the emit transitions in the band are a contiguous range of rows. Null rows are one per destination, in nullTrans order
+  SparseTransMatrix emitMatrix, nullMatrix;
+  vguard<OutputToken> emitRowOut;
+  vguard<double> emitRowLoopLogWeight;
+  bool scaledColumns;  // false if a transition weight is too small for fillColumnScaled to detect underflow
+
+  // scratch space for fillColumnScaled. colProb & colLostLogLike are the last scaled column, kept to start the next one:
+  // each cell is colProb times exp(colLogScale), plus exp(colLostLogLike) for any part that would underflow
+  vguard<double> colProb, colLostLogLike, prevProb, prevLostLogLike, rowSum, rowLogFactor;
+  vguard<char> rowLost;
+  vguard<StateIndex> lostDest;
+  double colLogScale;
+  OutputIndex colProbPos;
+  OutputIndex logColumnsLeft;  // columns to fill in log space before trying fillColumnScaled again
+
+  void compileTrans (const vguard<IndexedTrans>& trans, bool emit, SparseTransMatrix& matrix);
+  bool fillColumnScaled (OutputIndex outPos);  // returns false, leaving the column untouched, if the column has no finite cells or overflows
   void fillColumn (OutputIndex outPos);
   OutputIndex lastCheckpoint;
 
+protected:
+  // if scaled is false, every column is filled in log space (fillColumnScaled is never tried); for tests comparing the two
+  ForwardTraceMatrix (const EvaluatedMachine&, const GaussianModelParams&, const TraceMoments&, const TraceParams&, size_t blockBytes, double bandWidth, bool scaled);
+
 public:
   double logLike;
 
@@ -23,16 +23,24 @@ void GaussianModelCounts::init (const EvaluatedMachine& m) {
     gaussIndex[m.outputTokenizer.tok2sym[n]] = n - 1;
 }
 
-double GaussianModelCounts::add (const Machine& machine, const EvaluatedMachine& m, const GaussianModelParams& mp, const TraceMoments& t, const TraceParams& tp, size_t blockBytes, double bandWidth) {
+template<class Cell>
+static double addTraceCounts (MachineCounts& mc, vguard<GaussianCounts>& gauss, const EvaluatedMachine& m, const GaussianModelParams& mp, const TraceMoments& t, const TraceParams& tp, size_t blockBytes, double bandWidth) {
+  ForwardTraceMatrix<Cell> forward (m, mp, t, tp, blockBytes, bandWidth);
+  const BackwardTraceMatrix<Cell> backward (forward, &mc, &gauss);
+  return forward.logLike;
+}
+
+double GaussianModelCounts::add (const Machine& machine, const EvaluatedMachine& m, const GaussianModelParams& mp, const TraceMoments& t, const TraceParams& tp, size_t blockBytes, double bandWidth, bool singlePrecision) {
   MachineCounts mc (m);
-  ForwardTraceMatrix forward (m, mp, t, tp, blockBytes, bandWidth);
-  const BackwardTraceMatrix backward (forward, &mc, &gauss);
+  const double logLike = singlePrecision
+    ? addTraceCounts<float> (mc, gauss, m, mp, t, tp, blockBytes, bandWidth)
+    : addTraceCounts<double> (mc, gauss, m, mp, t, tp, blockBytes, bandWidth);
 
   const auto pc = mc.paramCounts (machine, mp.params (tp.rate));
   for (auto p_c: pc)
     prob[p_c.first] += p_c.second;
 
-  return forward.logLike;
+  return logLike;
 }
 
 void GaussianModelCounts::optimizeModelParams (GaussianModelParams& modelParams, const TraceListParams& traceListParams, const GaussianModelPrior& modelPrior, const list<EvaluatedMachine>& eval, const list<GaussianModelCounts>& modelCountsList) {
@@ -7,9 +7,16 @@
 #define MaxEMIterations 1000
 #define MinEMImprovement .001
 
+template<class Cell>
+static MachinePath viterbiPath (const Machine& machine, const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& trace, const TraceParams& traceParams, size_t blockBytes) {
+  ViterbiTraceMatrix<Cell> viterbi (eval, modelParams, trace, traceParams, blockBytes);
+  return viterbi.path (machine);
+}
+
 GaussianTrainer::GaussianTrainer() :
   blockBytes(0),
   bandWidth(1),
+  singlePrecision(false),
   fitTrace(true)
 { }
 
@@ -77,7 +84,7 @@ void GaussianModelFitter::fit() {
       Assert (trace.name == traceParams.name, "Trace name (%s) does not match trace parameters (%s)", trace.name.c_str(), traceParams.name.c_str());
       GaussianModelCounts c;
       c.init (eval);
-      logLike += c.add (machine, eval, modelParams, trace, traceParams, blockBytes, bandWidth);
+      logLike += c.add (machine, eval, modelParams, trace, traceParams, blockBytes, bandWidth, singlePrecision);
       counts.push_back (c);
       evalMachine.push_back (eval);
       LogThisAt(6,"Counts for trace #" << m << ", iteration #" << (iter+1) << ":" << endl << JsonWriter<GaussianModelCounts>::toJsonString(c) << endl);
@@ -114,7 +121,7 @@ vguard<FastSeq> GaussianDecoder::decode() {
 	const EvaluatedMachine eval (machineWithGenerator, modelParams.params (traceParams.rate));
 	GaussianModelCounts c;
 	c.init (eval);
-	logLike += c.add (machineWithGenerator, eval, modelParams, trace, traceParams, blockBytes, bandWidth);
+	logLike += c.add (machineWithGenerator, eval, modelParams, trace, traceParams, blockBytes, bandWidth, singlePrecision);
 	counts.push_back (c);
 	if (testFinished())
 	  break;
@@ -124,8 +131,9 @@ vguard<FastSeq> GaussianDecoder::decode() {
     }
     LogThisAt(3,"Base-calling trace " << trace.name << endl);
     const EvaluatedMachine eval (machineWithGenerator, modelParams.params (traceParams.rate));
-    ViterbiTraceMatrix viterbi (eval, modelParams, trace, traceParams, blockBytes);
-    const MachinePath path = viterbi.path(machineWithGenerator);
+    const MachinePath path = singlePrecision
+      ? viterbiPath<float> (machineWithGenerator, eval, modelParams, trace, traceParams, blockBytes)
+      : viterbiPath<double> (machineWithGenerator, eval, modelParams, trace, traceParams, blockBytes);
     LogThisAt(6,"Viterbi path:" << endl << trace.pathScoreBreakdown (machineWithGenerator, path, modelParams, traceParams) << endl);
     FastSeq fs;
     fs.name = trace.name;
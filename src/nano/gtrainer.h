@@ -19,6 +19,7 @@ struct GaussianTrainer {
 
   size_t blockBytes;
   double bandWidth;
+  bool singlePrecision;  // if true, DP cells are stored as float
   bool fitTrace;
   
   GaussianTrainer();
@@ -20,11 +20,10 @@ Minimizer::Minimizer (const WeightExpr& f) :
   LogThisAt(6,"Objective function: " << WeightAlgebra::toString(f,ParamDefs()) << endl);
   const auto p = WeightAlgebra::params (f, ParamDefs());
   paramName = vguard<string> (p.begin(), p.end());
-  for (const auto& n: paramName) {
-    const auto d = WeightAlgebra::deriv (func, ParamDefs(), n);
-    LogThisAt(7,"d(Objective)/d(" << n << "): " << WeightAlgebra::toString(d,ParamDefs()) << endl);
-    deriv.push_back (d);
-  }
+  for (const auto& n: paramName)
+    LogThisAt(7,"d(Objective)/d(" << n << "): " << WeightAlgebra::toString(WeightAlgebra::deriv (func, ParamDefs(), n),ParamDefs()) << endl);
+  tape = WeightTape (ParamDefs(), paramName);
+  tape.compile (func);
 }
 
 ParamDefs Minimizer::gsl_vector_to_params (const gsl_vector *v) const {
@@ -36,30 +35,32 @@ ParamDefs Minimizer::gsl_vector_to_params (const gsl_vector *v) const {
 
 double Minimizer::gsl_objective (const gsl_vector *v, void* voidMin) {
   const Minimizer& minimizer (*(Minimizer*)voidMin);
-  const ParamDefs p = minimizer.gsl_vector_to_params(v);
+  const double f = minimizer.tape.eval (gsl_vector_to_stl(v));
 
-  const double f = WeightAlgebra::eval (minimizer.func, p);
-
-  LogThisAt (8, WeightAlgebra::toJsonString(p) << endl);
+  LogThisAt (8, WeightAlgebra::toJsonString(minimizer.gsl_vector_to_params(v)) << endl);
   LogThisAt (7, "gsl_objective(" << to_string_join(gsl_vector_to_stl(v)) << ") = " << f << endl);
 
   return f;
 }
 
-void Minimizer::gsl_objective_deriv (const gsl_vector *v, void* voidMin, gsl_vector *df) {
-  const Minimizer& minimizer (*(Minimizer*)voidMin);
-  const ParamDefs p = minimizer.gsl_vector_to_params(v);
-
+// the objective and its whole gradient come from one forward and one backward sweep of the tape
+double Minimizer::gsl_objective_gradient (const gsl_vector *v, const Minimizer& minimizer, gsl_vector *df) {
+  vguard<double> grad;
+  const double f = minimizer.tape.gradient (gsl_vector_to_stl(v), grad);
   for (size_t n = 0; n < minimizer.paramName.size(); ++n)
-    gsl_vector_set (df, n, WeightAlgebra::eval (minimizer.deriv[n], p));
+    gsl_vector_set (df, n, grad[n]);
 
-  const vguard<double> v_stl = gsl_vector_to_stl(v), df_stl = gsl_vector_to_stl(df);
-  LogThisAt (7, "gsl_objective_deriv(" << to_string_join(v_stl) << ") = (" << to_string_join(df_stl) << ")" << endl);
+  LogThisAt (7, "gsl_objective_deriv(" << to_string_join(gsl_vector_to_stl(v)) << ") = (" << to_string_join(grad) << ")" << endl);
+  return f;
+}
+
+void Minimizer::gsl_objective_deriv (const gsl_vector *v, void* voidMin, gsl_vector *df) {
+  (void) gsl_objective_gradient (v, *(Minimizer*)voidMin, df);
 }
 
 void Minimizer::gsl_objective_with_deriv (const gsl_vector *x, void* voidMin, double *f, gsl_vector *df) {
-  *f = gsl_objective (x, voidMin);
-  gsl_objective_deriv (x, voidMin, df);
+  *f = gsl_objective_gradient (x, *(Minimizer*)voidMin, df);
+  LogThisAt (7, "gsl_objective(" << to_string_join(gsl_vector_to_stl(x)) << ") = " << *f << endl);
 }
   
 ParamDefs Minimizer::minimize (const ParamDefs& seed) const {
@@ -4,6 +4,7 @@
 #include <gsl/gsl_vector.h>
 #include "../vguard.h"
 #include "../weight.h"
+#include "../tape.h"
 
 struct Minimizer {
   double stepSize, lineSearchTolerance, epsilonAbsolute;
@@ -11,7 +12,7 @@ struct Minimizer {
 
   WeightExpr func;
   vguard<string> paramName;
-  vguard<WeightExpr> deriv;
+  WeightTape tape;  // func, with paramName as the slots; the gradient is found by reverse-mode differentiation
 
   Minimizer (const WeightExpr& f);
   ParamDefs minimize (const ParamDefs& seed) const;
@@ -19,6 +20,7 @@ struct Minimizer {
   ParamDefs gsl_vector_to_params (const gsl_vector *v) const;
 
   static double gsl_objective (const gsl_vector *v, void* minimizer);
+  static double gsl_objective_gradient (const gsl_vector *v, const Minimizer& minimizer, gsl_vector *df);  // returns objective
   static void gsl_objective_deriv (const gsl_vector *v, void* minimizer, gsl_vector *df);
   static void gsl_objective_with_deriv (const gsl_vector *x, void* minimizer, double *f, gsl_vector *df);
 };
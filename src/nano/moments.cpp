@@ -100,7 +100,7 @@ string TraceMoments::pathScoreBreakdown (const Machine& machine, const MachinePa
 	out << ", \"segment\": true";
       } else {
 	const SampleMoments& x = sample[pos++];
-	const GaussianCoefficients& gc = modelCoeffs.gauss[outputTokenizer.sym2tok.at (trans.out) - 1];
+	const GaussianCoefficients& gc = modelCoeffs.gauss[outputTokenizer.token (trans.out) - 1];
 	ignore = x.m0 - 1;
 	emit_ll = gc.logEmitProb(x);
 	out << ", \"emitLogLike\": " << emit_ll;
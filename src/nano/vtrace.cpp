@@ -1,48 +1,51 @@
 #include "vtrace.h"
 #include "../logger.h"
 
-ViterbiTraceMatrix::ViterbiTraceMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& trace, const TraceParams& traceParams, size_t blockBytes, double bandWidth) :
-  TraceDPMatrix (eval, modelParams, trace, traceParams, blockBytes, bandWidth)
+template<class Cell>
+ViterbiTraceMatrix<Cell>::ViterbiTraceMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& trace, const TraceParams& traceParams, size_t blockBytes, double bandWidth) :
+  TraceDPMatrix<Cell> (eval, modelParams, trace, traceParams, blockBytes, bandWidth)
 {
   ProgressLog(plog,3);
-  plog.initProgress ("Viterbi algorithm (%ld samples, %u states, %u transitions)", outLen, nStates, nTrans);
+  plog.initProgress ("Viterbi algorithm (%ld samples, %u states, %u transitions)", this->outLen, this->nStates, this->nTrans);
 
-  cell(0,eval.startState()) = 0;
-  for (const auto& it: nullTrans)
-    update (0, it.dest, cell(0,it.src) + it.logWeight, it.in);
+  this->cell(0,this->eval.startState()) = 0;
+  for (const auto& it: this->nullTrans)
+    update (0, it.dest, this->cell(0,it.src) + it.logWeight, it.in);
 
-  for (OutputIndex outPos = 1; outPos <= outLen; ++outPos) {
-    plog.logProgress ((outPos - 1) / (double) outLen, "sample %ld/%ld", outPos, outLen);
+  for (OutputIndex outPos = 1; outPos <= this->outLen; ++outPos) {
+    plog.logProgress ((outPos - 1) / (double) this->outLen, "sample %ld/%ld", outPos, this->outLen);
     fillColumn (outPos);
   }
 
-  logLike = cell (outLen, eval.endState());
+  logLike = this->cell (this->outLen, this->eval.endState());
   LogThisAt(6,"Viterbi log-likelihood: " << logLike << endl);
   LogThisAt(10,"Viterbi matrix:" << endl << *this);
 }
 
-void ViterbiTraceMatrix::fillColumn (OutputIndex outPos) {
-  vguard<double>& thisColumn = column(outPos);
-  initColumn (thisColumn);
-  const auto itBegin = bandTransBegin(outPos);
-  const auto itEnd = bandTransEnd(outPos);
+template<class Cell>
+void ViterbiTraceMatrix<Cell>::fillColumn (OutputIndex outPos) {
+  vguard<Cell>& thisColumn = this->column(outPos);
+  this->initColumn (thisColumn);
+  const auto itBegin = this->bandTransBegin(outPos);
+  const auto itEnd = this->bandTransEnd(outPos);
   for (auto itIter = itBegin; itIter != itEnd; ++itIter) {
     const auto& it = *itIter;
     const OutputToken outTok = it.out;
-    const double llEmit = logEmitProb(outPos,outTok);
-    update (outPos, it.dest, cell(outPos-1,it.src) + logTransProb(outPos,it) + llEmit, it.in);
+    const double llEmit = this->logEmitProb(outPos,outTok);
+    update (outPos, it.dest, this->cell(outPos-1,it.src) + this->logTransProb(outPos,it) + llEmit, it.in);
   }
 
-  for (const auto& it: nullTrans)
-    update (outPos, it.dest, cell(outPos,it.src) + it.logWeight, it.in);
+  for (const auto& it: this->nullTrans)
+    update (outPos, it.dest, this->cell(outPos,it.src) + it.logWeight, it.in);
 
-  lastCheckpoint = checkpoint(outPos);
+  lastCheckpoint = this->checkpoint(outPos);
 }
 
-void ViterbiTraceMatrix::readyColumn (OutputIndex outPos) {
-  const OutputIndex blockStart = checkpoint(outPos);
+template<class Cell>
+void ViterbiTraceMatrix<Cell>::readyColumn (OutputIndex outPos) {
+  const OutputIndex blockStart = this->checkpoint(outPos);
   if (blockStart != lastCheckpoint) {
-    const OutputIndex blockEnd = min((OutputIndex)nColumns,blockStart+blockSize) - 1;
+    const OutputIndex blockEnd = min((OutputIndex)this->nColumns,blockStart+this->blockSize) - 1;
     LogThisAt(4,"Refilling Viterbi matrix from sample " << (blockStart+1) << " to " << blockEnd << endl);
 
     for (OutputIndex outPos = blockStart + 1; outPos <= blockEnd; ++outPos)
@@ -50,16 +53,17 @@ void ViterbiTraceMatrix::readyColumn (OutputIndex outPos) {
   }
 }
 
-MachinePath ViterbiTraceMatrix::path (const Machine& m) {
+template<class Cell>
+MachinePath ViterbiTraceMatrix<Cell>::path (const Machine& m) {
   Assert (logLike > -numeric_limits<double>::infinity(), "Can't do Viterbi traceback: no finite-weight paths");
   ProgressLog(plog,3);
-  plog.initProgress ("Viterbi traceback (%ld samples, %u states, %u transitions)", outLen, nStates, nTrans);
+  plog.initProgress ("Viterbi traceback (%ld samples, %u states, %u transitions)", this->outLen, this->nStates, this->nTrans);
   MachinePath path;
-  OutputIndex outPos = outLen;
-  StateIndex s = nStates - 1;
+  OutputIndex outPos = this->outLen;
+  StateIndex s = this->nStates - 1;
   while (outPos > 0 || s != 0) {
-    plog.logProgress ((outLen - outPos) / (double) outLen, "sample %ld/%ld", outPos, outLen);
-    const EvaluatedMachineState& state = eval.state[s];
+    plog.logProgress ((this->outLen - outPos) / (double) this->outLen, "sample %ld/%ld", outPos, this->outLen);
+    const EvaluatedMachineState& state = this->eval.state[s];
     double bestLogLike = -numeric_limits<double>::infinity();
     const EvaluatedMachineState::Trans *bestTrans, *bestLoopTrans = NULL;
     StateIndex bestSource;
@@ -70,10 +74,10 @@ MachinePath ViterbiTraceMatrix::path (const Machine& m) {
 	const OutputToken outTok = outTok_stateTransMap.first;
 	if (outTok == 0 || outPos > 0)
 	  for (const auto& src_trans: outTok_stateTransMap.second) {
-	    const double tll = logIncomingProb (inTok, outTok, outPos, src_trans.first, s, src_trans.second);
+	    const double tll = this->logIncomingProb (inTok, outTok, outPos, src_trans.first, s, src_trans.second);
 	    if (tll > bestLogLike) {
 	      bestLogLike = tll;
-	      bestLoopTrans = getLoopTrans (inTok, outTok, s);
+	      bestLoopTrans = this->getLoopTrans (inTok, outTok, s);
 	      bestSource = src_trans.first;
 	      bestTrans = &src_trans.second;
 	    }
@@ -84,7 +88,7 @@ MachinePath ViterbiTraceMatrix::path (const Machine& m) {
     if (!bestMachineTrans.outputEmpty()) {
       if (bestLoopTrans) {
 	const MachineTransition& bestLoopMachineTrans = m.state[s].getTransition (bestLoopTrans->transIndex);
-	const auto& mom = moments.sample[outPos-1];
+	const auto& mom = this->moments.sample[outPos-1];
 	for (int n = 1; n < mom.m0; ++n)
 	  path.trans.push_front (bestLoopMachineTrans);
       }
@@ -95,3 +99,6 @@ MachinePath ViterbiTraceMatrix::path (const Machine& m) {
   }
   return path;
 }
+
+template class ViterbiTraceMatrix<float>;
+template class ViterbiTraceMatrix<double>;
@@ -3,11 +3,16 @@
 
 #include "dptrace.h"
 
-class ViterbiTraceMatrix : public TraceDPMatrix {
+template<class Cell>
+class ViterbiTraceMatrix : public TraceDPMatrix<Cell> {
+public:
+  typedef typename TraceDPMatrix<Cell>::OutputIndex OutputIndex;
+
 private:
   inline void update (OutputIndex outPos, StateIndex state, double newLogLike, InputToken inTok) {
-    double& ll = cell(outPos,state);
-    ll = inTok ? max(ll,newLogLike) : log_sum_exp(ll,newLogLike);
+    Cell& cell = this->cell(outPos,state);
+    const double ll = cell;
+    cell = inTok ? max(ll,newLogLike) : log_sum_exp(ll,newLogLike);
   }
 
   void fillColumn (OutputIndex outPos);
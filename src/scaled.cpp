@@ -0,0 +1,150 @@
+#include <float.h>
+#include "scaled.h"
+#include "logger.h"
+
+// A product of a normal cell and a weight of at least DBL_EPSILON cannot round to zero,
+// so a cell that received any nonzero contribution is nonzero, and underflow is caught when the row is rescaled.
+// Machines with smaller weights are left to the log-space engine
+ScaledDPMatrix::ScaledDPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options, const DPEnvelope& envelope, const EvaluatedTransTable& table) :
+  DPMatrix<double> (machine, seqPair, options, envelope),
+  logScale (inLen + 1, 0.),
+  underflow (false)
+{
+  Assert (options.xDrop <= 0 && !options.blockBytes, "Scaled DP matrices do not support X-drop or checkpointing");
+  weight.reserve (table.trans.size());
+  for (const auto& trans: table.trans) {
+    weight.push_back (exp (trans.logWeight));
+    if (weight.back() > 0 && weight.back() < DBL_EPSILON)
+      underflow = true;
+  }
+  // cells start at probability zero, rather than log-likelihood -infinity
+  for (InputIndex inPos = 0; inPos <= inLen; ++inPos) {
+    const OutputIndex outBegin = this->envelope().outBegin[inPos], outEnd = this->envelope().outEnd[inPos];
+    if (outBegin < outEnd)
+      fill (&cellRef (inPos, outBegin, 0), &cellRef (inPos, outEnd - 1, 0) + nStates, 0.);
+  }
+}
+
+void ScaledDPMatrix::rescaleRow (InputIndex inPos, double prevLogScale) {
+  logScale[inPos] = prevLogScale;
+  const OutputIndex outBegin = envelope().outBegin[inPos], outEnd = envelope().outEnd[inPos];
+  if (outBegin >= outEnd)
+    return;
+  double *rowBegin = &cellRef (inPos, outBegin, 0), *rowEnd = rowBegin + (outEnd - outBegin) * nStates;
+  const double rowMax = *max_element (rowBegin, rowEnd);
+  if (!(rowMax <= DBL_MAX)) {
+    underflow = true;  // overflow, really, but the remedy is the same
+    return;
+  }
+  if (rowMax == 0)
+    return;
+  // scaling by a power of two is exact, unless the result is subnormal
+  int exponent;
+  (void) frexp (rowMax, &exponent);
+  const double scale = ldexp (1., -exponent);
+  for (double* c = rowBegin; c != rowEnd; ++c)
+    if (*c > 0 && (*c < DBL_MIN || (*c *= scale) < DBL_MIN)) {
+      underflow = true;
+      return;
+    }
+  logScale[inPos] += exponent * M_LN2;
+}
+
+// Row inPos is filled in the scale of row inPos-1, which it reads, then rescaled
+ScaledForwardMatrix::ScaledForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  ScaledDPMatrix (machine, seqPair, options, DPEnvelope(), machine.incoming)
+{
+  if (inEnvelope (0, 0))
+    cellRef (0, 0, machine.startState()) = 1;
+  for (InputIndex row = 0; row <= inLen && !underflow; ++row) {
+    forEachCell (row, row + 1, false, true, [this] (InputIndex inPos, OutputIndex outPos) {
+	double* cell = &cellRef (inPos, outPos, 0);
+	const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
+	const OutputToken outTok = outPos ? output[outPos-1] : OutputTokenizer::emptyToken();
+	if (inPos && outPos)
+	  accumulateClass<true> (cell, this->machine.incoming, inTok, outTok, inPos - 1, outPos - 1);
+	if (inPos)
+	  accumulateClass<true> (cell, this->machine.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
+	if (outPos)
+	  accumulateClass<true> (cell, this->machine.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
+	accumulateClass<true> (cell, this->machine.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+      });
+    rescaleRow (row, row ? logScale[row-1] : 0.);
+  }
+  if (underflow)
+    LogThisAt(7,"Underflow in scaled Forward matrix" << endl);
+  LogThisAt(8,"Scaled Forward matrix:" << endl << *this);
+}
+
+double ScaledForwardMatrix::logLike() const {
+  return cellLogLike (inLen, outLen, machine.endState());
+}
+
+ScaledBackwardMatrix::ScaledBackwardMatrix (const ScaledForwardMatrix& forward) :
+  ScaledDPMatrix (forward.machine, forward.seqPair, forward.options, forward.envelope(), forward.machine.outgoing)
+{
+  if (inEnvelope (inLen, outLen))
+    cellRef (inLen, outLen, machine.endState()) = 1;
+  for (InputIndex row = inLen; row >= 0 && !underflow; --row) {
+    forEachCell (row, row + 1, true, true, [this] (InputIndex inPos, OutputIndex outPos) {
+	double* cell = &cellRef (inPos, outPos, 0);
+	const bool endOfInput = (inPos == inLen);
+	const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+	const bool endOfOutput = (outPos == outLen);
+	const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+	if (!endOfInput && !endOfOutput)
+	  accumulateClass<false> (cell, this->machine.outgoing, inTok, outTok, inPos + 1, outPos + 1);
+	if (!endOfInput)
+	  accumulateClass<false> (cell, this->machine.outgoing, inTok, OutputTokenizer::emptyToken(), inPos + 1, outPos);
+	if (!endOfOutput)
+	  accumulateClass<false> (cell, this->machine.outgoing, InputTokenizer::emptyToken(), outTok, inPos, outPos + 1);
+	accumulateClass<false> (cell, this->machine.outgoing, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+      });
+    rescaleRow (row, row < inLen ? logScale[row+1] : 0.);
+  }
+  if (underflow)
+    LogThisAt(7,"Underflow in scaled Backward matrix" << endl);
+  LogThisAt(8,"Scaled Backward matrix:" << endl << *this);
+}
+
+double ScaledBackwardMatrix::logLike() const {
+  return cellLogLike (0, 0, machine.startState());
+}
+
+// The posterior count of a transition is F(src) * weight * B(dest) * exp(logNorm), where logNorm combines the two rows' scales with the log-likelihood.
+// If exp(logNorm) is out of range, the product is formed in log space instead
+void ScaledBackwardMatrix::countClass (const ScaledForwardMatrix& forward, MachineCounts& counts, double logNorm, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, InputIndex destInPos, OutputIndex destOutPos) const {
+  if (!inEnvelope (destInPos, destOutPos))
+    return;
+  const EvaluatedTransTable& table = machine.outgoing;
+  const double* w = weight.data() + (table.begin (inTok, outTok) - table.trans.begin());
+  const bool inRange = fabs (logNorm) < 700;
+  const double norm = exp (logNorm);
+  for (auto iter = table.begin (inTok, outTok), end = table.end (inTok, outTok); iter != end; ++iter, ++w) {
+    const double f = forward.storedCell (inPos, outPos, iter->src), b = storedCell (destInPos, destOutPos, iter->dest);
+    if (f > 0 && b > 0)
+      counts.count[iter->src][iter->transIndex] += inRange ? (f * *w * b * norm) : exp (log(f) + iter->logWeight + log(b) + logNorm);
+  }
+}
+
+void ScaledBackwardMatrix::getCounts (const ScaledForwardMatrix& forward, MachineCounts& counts) const {
+  Assert (!forward.underflow && !underflow, "Can't get counts from scaled matrices that underflowed");
+  const double ll = logLike();
+  for (InputIndex inPos = inLen; inPos >= 0; --inPos) {
+    const bool endOfInput = (inPos == inLen);
+    const InputToken inTok = endOfInput ? InputTokenizer::emptyToken() : input[inPos];
+    const double sameRowLogNorm = forward.logScale[inPos] + logScale[inPos] - ll;
+    const double nextRowLogNorm = endOfInput ? 0 : (forward.logScale[inPos] + logScale[inPos+1] - ll);
+    for (OutputIndex outPos = envelope().outEnd[inPos] - 1; outPos >= envelope().outBegin[inPos]; --outPos) {
+      const bool endOfOutput = (outPos == outLen);
+      const OutputToken outTok = endOfOutput ? OutputTokenizer::emptyToken() : output[outPos];
+      if (!endOfInput && !endOfOutput)
+	countClass (forward, counts, nextRowLogNorm, inTok, outTok, inPos, outPos, inPos + 1, outPos + 1);
+      if (!endOfInput)
+	countClass (forward, counts, nextRowLogNorm, inTok, OutputTokenizer::emptyToken(), inPos, outPos, inPos + 1, outPos);
+      if (!endOfOutput)
+	countClass (forward, counts, sameRowLogNorm, InputTokenizer::emptyToken(), outTok, inPos, outPos, inPos, outPos + 1);
+      countClass (forward, counts, sameRowLogNorm, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, inPos, outPos);
+    }
+  }
+}
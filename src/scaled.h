@@ -0,0 +1,62 @@
+#ifndef SCALED_INCLUDED
+#define SCALED_INCLUDED
+
+#include "dpmatrix.h"
+#include "counts.h"
+
+// Forward-Backward in probability space: each transition costs a multiply-add, rather than an add and a log_sum_exp.
+// Cells hold probabilities rather than log-likelihoods. Each row is rescaled by a power of two once it is filled,
+// so that its largest cell lies in [1/2,1), and the log of the scale factor is kept in logScale.
+// Every cell of a row is in the same scale, so the within-row dynamic range must fit in a double:
+// if any nonzero cell falls below the smallest normal double (or a row overflows), underflow is set, the fill stops,
+// and the caller should fall back to the log-space ForwardMatrix & BackwardMatrix.
+// The rows are filled in order, serially; X-drop envelopes and checkpointing are not supported
+class ScaledDPMatrix : public DPMatrix<double> {
+protected:
+  vguard<double> weight;  // weight[k] = exp(logWeight) of the k'th transition of the table that the fill uses
+
+  ScaledDPMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options, const DPEnvelope& envelope, const EvaluatedTransTable& table);
+
+  // Fill kernel for the transitions of one class into (Forward) or out of (Backward) cell, which is provisionally in the scale of the other cell's row.
+  // As in DPMatrix::reduceClass, silent transitions read finished values
+  template<bool Forward>
+  inline void accumulateClass (double* cell, const EvaluatedTransTable& table, InputToken inTok, OutputToken outTok, InputIndex otherInPos, OutputIndex otherOutPos) {
+    if (!inEnvelope (otherInPos, otherOutPos))
+      return;
+    const double* otherCell = &cellRef (otherInPos, otherOutPos, 0);
+    const double* w = weight.data() + (table.begin (inTok, outTok) - table.trans.begin());
+    for (auto iter = table.begin (inTok, outTok), end = table.end (inTok, outTok); iter != end; ++iter, ++w)
+      cell[Forward ? iter->dest : iter->src] += otherCell[Forward ? iter->src : iter->dest] * *w;
+  }
+
+  // rescales a filled row, whose cells are provisionally in the scale of the row it was filled from, setting underflow if the row cannot be represented
+  void rescaleRow (InputIndex inPos, double prevLogScale);
+
+public:
+  vguard<double> logScale;  // cell (inPos,outPos,state) has log-likelihood log(storedCell(inPos,outPos,state)) + logScale[inPos]
+  bool underflow;
+
+  // log-likelihood of a cell, or -infinity if it is outside the envelope
+  inline double cellLogLike (InputIndex inPos, OutputIndex outPos, StateIndex state) const {
+    return inEnvelope (inPos, outPos) ? log (storedCell (inPos, outPos, state)) + logScale[inPos] : -numeric_limits<double>::infinity();
+  }
+};
+
+class ScaledForwardMatrix : public ScaledDPMatrix {
+public:
+  ScaledForwardMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options = DPOptions());
+  double logLike() const;
+};
+
+class ScaledBackwardMatrix : public ScaledDPMatrix {
+private:
+  // adds the posterior counts of the transitions of one class from the cell at inPos,outPos, given the normalizer exp(logNorm) of its cell pair
+  void countClass (const ScaledForwardMatrix& forward, MachineCounts& counts, double logNorm, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos, InputIndex destInPos, OutputIndex destOutPos) const;
+
+public:
+  ScaledBackwardMatrix (const ScaledForwardMatrix& forward);  // uses the same envelope as the Forward matrix
+  void getCounts (const ScaledForwardMatrix&, MachineCounts&) const;
+  double logLike() const;
+};
+
+#endif /* SCALED_INCLUDED */
@@ -0,0 +1,61 @@
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include "symbol.h"
+#include "util.h"
+
+// Strings are stored in fixed-size pages, which never move once allocated,
+// so a reader can find a symbol's string while another thread is interning a new one
+namespace {
+  const SymbolId pageBits = 12, pageSize = 1 << pageBits, maxPages = 1 << 12;
+
+  struct SymbolTable {
+    mutex mx;
+    unordered_map<string,SymbolId> strId;
+    atomic<string*> page[maxPages];
+    SymbolId nSymbols;
+    SymbolTable() : nSymbols(1) {
+      for (auto& p: page)
+	p.store (NULL, memory_order_relaxed);
+      page[0].store (new string[pageSize], memory_order_release);  // page[0][0] is the empty symbol
+    }
+  };
+
+  SymbolTable& symbolTable() {
+    static SymbolTable table;
+    return table;
+  }
+}
+
+SymbolId MachineSymbol::intern (const string& s) {
+  SymbolTable& table = symbolTable();
+  lock_guard<mutex> lock (table.mx);
+  const auto iter = table.strId.find (s);
+  if (iter != table.strId.end())
+    return iter->second;
+  const SymbolId id = table.nSymbols;
+  Assert (id / pageSize < maxPages, "Too many distinct transition labels");
+  string* p = table.page[id / pageSize].load (memory_order_relaxed);
+  if (!p) {
+    p = new string[pageSize];
+    table.page[id / pageSize].store (p, memory_order_release);
+  }
+  p[id % pageSize] = s;
+  table.strId[s] = id;
+  ++table.nSymbols;
+  return id;
+}
+
+const string& MachineSymbol::str() const {
+  return symbolTable().page[symId / pageSize].load (memory_order_acquire) [symId % pageSize];
+}
+
+SymbolId MachineSymbol::nSymbols() {
+  SymbolTable& table = symbolTable();
+  lock_guard<mutex> lock (table.mx);
+  return table.nSymbols;
+}
+
+ostream& operator<< (ostream& out, const MachineSymbol& s) {
+  return out << s.str();
+}
@@ -0,0 +1,53 @@
+#ifndef SYMBOL_INCLUDED
+#define SYMBOL_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <cstdint>
+
+using namespace std;
+
+typedef uint32_t SymbolId;
+
+// An interned transition label. Each distinct string is stored once, in a global table, and a MachineSymbol is its 32-bit index,
+// so symbols are copied, tested for equality and hashed as integers. The empty string (no symbol) is ID 0, and needs no lookup.
+// IDs are assigned in the order labels are first seen, so operator< still compares the strings (of unequal symbols): sorted containers of symbols,
+// and the transition order of machines built with them (e.g. by TransAccumulator), are as they were with string labels.
+// Internal containers whose order never reaches the output should key on id() instead.
+// The table only grows. Interning is thread-safe, and finding the string for an ID takes no lock
+class MachineSymbol {
+private:
+  SymbolId symId;
+  static SymbolId intern (const string&);
+
+public:
+  MachineSymbol() : symId(0) { }
+  MachineSymbol (const string& s) : symId (s.empty() ? 0 : intern(s)) { }
+  MachineSymbol (const char* s) : MachineSymbol (string (s)) { }
+
+  SymbolId id() const { return symId; }
+  const string& str() const;
+  operator const string&() const { return str(); }
+  const char* c_str() const { return str().c_str(); }
+  bool empty() const { return symId == 0; }
+
+  bool operator== (const MachineSymbol& s) const { return symId == s.symId; }
+  bool operator!= (const MachineSymbol& s) const { return symId != s.symId; }
+  bool operator< (const MachineSymbol& s) const { return symId != s.symId && str() < s.str(); }
+  bool operator== (const string& s) const { return str() == s; }
+  bool operator!= (const string& s) const { return str() != s; }
+  bool operator== (const char* s) const { return str() == s; }
+  bool operator!= (const char* s) const { return str() != s; }
+
+  static SymbolId nSymbols();  // including the empty symbol
+};
+
+ostream& operator<< (ostream& out, const MachineSymbol& s);
+
+namespace std {
+  template<> struct hash<MachineSymbol> {
+    size_t operator() (const MachineSymbol& s) const { return s.id(); }
+  };
+}
+
+#endif /* SYMBOL_INCLUDED */
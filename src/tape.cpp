@@ -0,0 +1,181 @@
+#include <math.h>
+#include <string.h>
+#include "tape.h"
+#include "util.h"
+
+WeightTape::WeightTape()
+{ }
+
+WeightTape::WeightTape (const ParamDefs& defs, const vguard<string>& paramName) :
+  defs (defs),
+  paramName (paramName)
+{
+  for (size_t n = 0; n < paramName.size(); ++n)
+    paramSlot[paramName[n]] = n;
+}
+
+WeightTape::WeightTape (const ParamDefs& allDefs) {
+  for (const auto& nd: allDefs)
+    if (nd.second.is_number()) {
+      paramSlot[nd.first] = paramName.size();
+      paramName.push_back (nd.first);
+    } else
+      defs[nd.first] = nd.second;
+}
+
+bool WeightTape::slotValues (const ParamDefs& allDefs, vguard<double>& paramValue) const {
+  paramValue = vguard<double> (paramName.size());
+  size_t nDefs = 0;
+  for (const auto& nd: allDefs)
+    if (nd.second.is_number()) {
+      const auto iter = paramSlot.find (nd.first);
+      if (iter == paramSlot.end())
+	return false;
+      paramValue[iter->second] = nd.second.get<double>();
+    } else {
+      const auto iter = defs.find (nd.first);
+      if (iter == defs.end() || iter->second != nd.second)
+	return false;
+      ++nDefs;
+    }
+  return nDefs == defs.size() && allDefs.size() == nDefs + paramName.size();
+}
+
+// Addition and multiplication are exactly commutative in floating point, so their operands are ordered, letting x+y and y+x share a register
+size_t WeightTape::push (Opcode op, size_t x, size_t y, double value) {
+  if ((op == Add || op == Multiply) && y < x)
+    swap (x, y);
+  uint64_t bits;
+  memcpy (&bits, &value, sizeof(bits));
+  const auto key = make_tuple (op, x, y, bits);
+  const auto iter = instrReg.find (key);
+  if (iter != instrReg.end())
+    return iter->second;
+  instr.push_back (Instruction { op, x, y, value });
+  instrReg[key] = instr.size() - 1;
+  return instr.size() - 1;
+}
+
+size_t WeightTape::compile (const WeightExpr& w) {
+  set<string> excludedDefs;
+  result.push_back (compile (w, excludedDefs));
+  return result.size() - 1;
+}
+
+// Follows the same rules as WeightAlgebra::eval, which excludes a definition while evaluating it, so cyclic definitions are errors
+size_t WeightTape::compile (const WeightExpr& w, set<string>& excludedDefs) {
+  const string op = WeightAlgebra::opcode(w);
+  if (op == "null") return push (Const);
+  if (op == "boolean") return push (Const, 0, 0, w.get<bool>() ? 1. : 0.);
+  if (op == "int" || op == "float") return push (Const, 0, 0, w.get<double>());
+  if (op == "param") {
+    const string n = w.get<string>();
+    if (excludedDefs.count(n))
+      throw runtime_error(string("Parameter ") + n + (" not defined"));
+    if (defs.count(n)) {
+      if (defReg.count(n))
+	return defReg.at(n);
+      const auto& val = defs.at(n);
+      size_t reg;
+      if (val.is_number())
+	reg = push (Const, 0, 0, val.get<double>());
+      else {
+	excludedDefs.insert (n);
+	reg = compile (val, excludedDefs);
+	excludedDefs.erase (n);
+      }
+      defReg[n] = reg;
+      return reg;
+    }
+    if (!paramSlot.count(n))
+      throw runtime_error(string("Parameter ") + n + (" not defined"));
+    return push (Param, paramSlot.at(n));
+  }
+  if (op == "log") return push (Log, compile (w.at("log"), excludedDefs));
+  if (op == "exp") return push (Exp, compile (w.at("exp"), excludedDefs));
+  const json& args = WeightAlgebra::operands(w);
+  const size_t x = compile (args[0], excludedDefs);
+  const size_t y = compile (args[1], excludedDefs);
+  if (op == "*") return push (Multiply, x, y);
+  if (op == "/") return push (Divide, x, y);
+  if (op == "+") return push (Add, x, y);
+  if (op == "-") return push (Subtract, x, y);
+  if (op == "pow") return push (Power, x, y);
+  Abort("Unknown opcode: %s", op.c_str());
+  return 0;
+}
+
+void WeightTape::eval (const vguard<double>& paramValue, vguard<double>& reg) const {
+  Assert (paramValue.size() == paramName.size(), "Expected %lu parameter values, got %lu", paramName.size(), paramValue.size());
+  reg.resize (instr.size());
+  const Instruction* in = instr.data();
+  double* r = reg.data();
+  for (size_t n = 0; n < instr.size(); ++n, ++in)
+    switch (in->op) {
+    case Const: r[n] = in->value; break;
+    case Param: r[n] = paramValue[in->x]; break;
+    case Log: r[n] = log (r[in->x]); break;
+    case Exp: r[n] = exp (r[in->x]); break;
+    case Multiply: r[n] = r[in->x] * r[in->y]; break;
+    case Divide: r[n] = r[in->x] / r[in->y]; break;
+    case Add: r[n] = r[in->x] + r[in->y]; break;
+    case Subtract: r[n] = r[in->x] - r[in->y]; break;
+    case Power: r[n] = pow (r[in->x], r[in->y]); break;
+    default: Abort ("Unknown tape instruction"); break;
+    }
+}
+
+// Adjoints follow the same rules as WeightAlgebra::deriv, e.g. (a^b)' = a^b (b'*log(a) + a'b/a)
+double WeightTape::gradient (const vguard<double>& paramValue, vguard<double>& grad, size_t n) const {
+  vguard<double> reg;
+  eval (paramValue, reg);
+  vguard<double> adjoint (result[n] + 1, 0.);
+  adjoint[result[n]] = 1;
+  grad = vguard<double> (paramName.size(), 0.);
+  backward (reg, adjoint, grad);
+  return reg[result[n]];
+}
+
+void WeightTape::sumGradient (const vguard<double>& reg, const vguard<double>& resultWeight, vguard<double>& grad) const {
+  Assert (resultWeight.size() == result.size(), "Tape has %lu results, but %lu weights", result.size(), resultWeight.size());
+  vguard<double> adjoint (instr.size(), 0.);
+  for (size_t n = 0; n < result.size(); ++n)
+    adjoint[result[n]] += resultWeight[n];
+  grad = vguard<double> (paramName.size(), 0.);
+  backward (reg, adjoint, grad);
+}
+
+void WeightTape::backward (const vguard<double>& reg, vguard<double>& adjoint, vguard<double>& grad) const {
+  const double* r = reg.data();
+  double* adj = adjoint.data();
+  for (size_t k = adjoint.size(); k > 0; --k) {
+    const size_t m = k - 1;
+    const double a = adj[m];
+    if (a == 0)
+      continue;
+    const Instruction& in = instr[m];
+    switch (in.op) {
+    case Const: break;
+    case Param: grad[in.x] += a; break;
+    case Log: adj[in.x] += a / r[in.x]; break;
+    case Exp: adj[in.x] += a * r[m]; break;
+    case Multiply: adj[in.x] += a * r[in.y]; adj[in.y] += a * r[in.x]; break;
+    case Divide: adj[in.x] += a / r[in.y]; adj[in.y] -= a * r[m] / r[in.y]; break;
+    case Add: adj[in.x] += a; adj[in.y] += a; break;
+    case Subtract: adj[in.x] += a; adj[in.y] -= a; break;
+    case Power:
+      adj[in.x] += a * r[m] * r[in.y] / r[in.x];
+      if (instr[in.y].op != Const)
+	adj[in.y] += a * r[m] * log (r[in.x]);
+      break;
+    default: Abort ("Unknown tape instruction"); break;
+    }
+  }
+}
+
+double WeightTape::eval (const vguard<double>& paramValue) const {
+  Assert (result.size(), "Empty tape");
+  vguard<double> reg;
+  eval (paramValue, reg);
+  return value (reg, 0);
+}
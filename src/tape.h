@@ -0,0 +1,60 @@
+#ifndef TAPE_INCLUDED
+#define TAPE_INCLUDED
+
+#include <tuple>
+#include <cstdint>
+#include "weight.h"
+#include "vguard.h"
+
+// One or more WeightExpr's compiled into a flat instruction tape, for fast repeated evaluation.
+// Parameters with definitions are inlined at compile time (each definition is compiled once, and shared);
+// the remaining parameters are read from integer slots, whose values are supplied at evaluation time.
+// Instruction n writes register n, reading only registers before n, so evaluation is a single forward loop.
+// Instructions are hash-consed: structurally identical subexpressions (of the same or different WeightExpr's) compile to one register,
+// so each is evaluated once per set of parameter values, however many times it is repeated in the trees.
+struct WeightTape {
+  enum Opcode { Const, Param, Log, Exp, Multiply, Divide, Add, Subtract, Power };
+  struct Instruction {
+    Opcode op;
+    size_t x, y;  // operand registers (y is unused by Log and Exp); for Param, x is the slot
+    double value;  // for Const
+  };
+
+  ParamDefs defs;
+  vguard<string> paramName;  // paramName[slot]
+  map<string,size_t> paramSlot;
+  vguard<Instruction> instr;
+  vguard<size_t> result;  // result[n] is the register holding the value of the n'th compiled expression
+
+  WeightTape();
+  WeightTape (const ParamDefs& defs, const vguard<string>& paramName);
+  // the parameters with numeric values in defs become slots, and the remaining definitions are inlined
+  explicit WeightTape (const ParamDefs& defs);
+
+  // sets paramValue to the slot values in defs. Returns false if defs doesn't have the slots and inlined definitions this tape was compiled with
+  bool slotValues (const ParamDefs& defs, vguard<double>& paramValue) const;
+
+  // compiles w, returning its index in result. Throws if w uses a parameter that is neither defined nor a slot
+  size_t compile (const WeightExpr& w);
+
+  // evaluates every instruction into reg, given paramValue[slot]
+  void eval (const vguard<double>& paramValue, vguard<double>& reg) const;
+  double eval (const vguard<double>& paramValue) const;  // value of the first compiled expression
+
+  // reverse-mode differentiation: one forward sweep to evaluate the tape, then one backward sweep propagating adjoints,
+  // setting grad[slot] to the derivative of the n'th compiled expression with respect to paramValue[slot]. Returns the expression's value
+  double gradient (const vguard<double>& paramValue, vguard<double>& grad, size_t n = 0) const;
+  // as above, for the sum over n of resultWeight[n] times the n'th compiled expression, in a single backward sweep; reg must be set by eval
+  void sumGradient (const vguard<double>& reg, const vguard<double>& resultWeight, vguard<double>& grad) const;
+
+  inline double value (const vguard<double>& reg, size_t n) const { return reg[result[n]]; }
+
+private:
+  map<string,size_t> defReg;  // registers holding already-compiled definitions
+  map<tuple<Opcode,size_t,size_t,uint64_t>,size_t> instrReg;  // register of each distinct instruction, keyed on the bits of its value
+  size_t compile (const WeightExpr& w, set<string>& excludedDefs);
+  size_t push (Opcode op, size_t x = 0, size_t y = 0, double value = 0);
+  void backward (const vguard<double>& reg, vguard<double>& adjoint, vguard<double>& grad) const;  // propagates adjoint down from its last register, adding into grad
+};
+
+#endif /* TAPE_INCLUDED */
@@ -94,3 +94,16 @@ std::string escaped_str (std::string const& s) {
   write_escaped (s, back_inserter (outs));
   return outs;
 }
+
+// Checkpointed DP: S = storageRows, M = maxStorageRows, T = totalRows, X = blockSize
+// X + (T/X) = S
+// If M is large enough, we can set S=M so that all available storage is used:
+//  X + (T/X) = M
+//  X^2 - MX + T = 0
+//  X = (M + sqrt(M^2 - 4T)) / 2
+// The condition for this is M^2 - 4T >= 0
+// Otherwise, we just minimize S via dS/dX=0, yielding X=sqrt(T) and S=2*sqrt(T)
+size_t calcBlockSize (size_t maxStorageRows, size_t totalRows) {
+  const double discriminant = pow ((double) maxStorageRows, 2) - 4 * (double) totalRows;
+  return ceil (discriminant >= 0 ? ((maxStorageRows + sqrt(discriminant)) / 2) : sqrt ((double) totalRows));
+}
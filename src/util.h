@@ -216,6 +216,9 @@ const T& random_key_log (const std::map<T,double>& logWeight, Generator& generat
   return (*iter).first;
 }
 
+/* block size for a checkpointed DP with totalRows rows, storing at most maxStorageRows rows at once */
+size_t calcBlockSize (size_t maxStorageRows, size_t totalRows);
+
 /* index sort
    http://stackoverflow.com/questions/10580982/c-sort-keeping-track-of-indices
  */
@@ -1,55 +1,59 @@
 #include "viterbi.h"
 #include "logger.h"
 
-ViterbiMatrix::ViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair) :
-  DPMatrix (machine, seqPair)
+template<class Cell>
+ViterbiMatrix<Cell>::ViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options) :
+  DPMatrix<Cell> (machine, seqPair, options)
 {
-  for (InputIndex inPos = 0; inPos <= inLen; ++inPos) {
-    const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
-    for (OutputIndex outPos = 0; outPos <= outLen; ++outPos) {
-      const OutputToken outTok = outPos ? output[outPos-1] : OutputTokenizer::emptyToken();
-      for (StateIndex d = 0; d < nStates; ++d) {
-	const EvaluatedMachineState& state = machine.state[d];
-	double ll = (inPos || outPos || d) ? -numeric_limits<double>::infinity() : 0;
-	if (inPos && outPos)
-	  accumulate (ll, state.incoming, inTok, outTok, inPos - 1, outPos - 1, max_reduce);
-	if (inPos)
-	  accumulate (ll, state.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos, max_reduce);
-	if (outPos)
-	  accumulate (ll, state.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1, max_reduce);
-	accumulate (ll, state.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos, max_reduce);
-	cell(inPos,outPos,d) = ll;
-      }
-    }
-  }
+  this->template fillIncoming<MaxProductSemiring>();
   LogThisAt(8,"Viterbi matrix:" << endl << *this);
 }
 
-double ViterbiMatrix::logLike() const {
-  return cell (inLen, outLen, machine.endState());
+template<class Cell>
+double ViterbiMatrix<Cell>::logLike() const {
+  return this->cell (this->inLen, this->outLen, this->machine.endState());
+}
+
+template<class Cell>
+MachinePath ViterbiMatrix<Cell>::path (const Machine& m) {
+  return path (&m);
 }
 
-MachinePath ViterbiMatrix::path (const Machine& m) const {
+template<class Cell>
+MachinePath ViterbiMatrix<Cell>::path() {
+  return path ((const Machine*) NULL);
+}
+
+template<class Cell>
+MachinePath ViterbiMatrix<Cell>::path (const Machine* m) {
+  const vguard<InputToken>& input = this->input;
+  const vguard<OutputToken>& output = this->output;
   Assert (logLike() > -numeric_limits<double>::infinity(), "Can't do traceback: no finite-weight paths");
   MachinePath path;
-  InputIndex inPos = inLen;
-  OutputIndex outPos = outLen;
-  StateIndex s = nStates - 1;
+  InputIndex inPos = this->inLen;
+  OutputIndex outPos = this->outLen;
+  StateIndex s = this->nStates - 1;
   while (inPos > 0 || outPos > 0 || s != 0) {
-    const EvaluatedMachineState& state = machine.state[s];
+    this->template readyRow<MaxProductSemiring> (inPos);
+    if (inPos)
+      this->template readyRow<MaxProductSemiring> (inPos - 1);
     double bestLogLike = -numeric_limits<double>::infinity();
     StateIndex bestSource;
     EvaluatedMachineState::TransIndex bestTransIndex;
+    InputToken bestInTok;
+    OutputToken bestOutTok;
     const InputToken inTok = inPos ? input[inPos-1] : InputTokenizer::emptyToken();
     const OutputToken outTok = outPos ? output[outPos-1] : OutputTokenizer::emptyToken();
     if (inPos && outPos)
-      pathIterate (bestLogLike, bestSource, bestTransIndex, state.incoming, inTok, outTok, inPos - 1, outPos - 1);
+      pathIterate (bestLogLike, bestSource, bestTransIndex, bestInTok, bestOutTok, s, inTok, outTok, inPos - 1, outPos - 1);
     if (inPos)
-      pathIterate (bestLogLike, bestSource, bestTransIndex, state.incoming, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
+      pathIterate (bestLogLike, bestSource, bestTransIndex, bestInTok, bestOutTok, s, inTok, OutputTokenizer::emptyToken(), inPos - 1, outPos);
     if (outPos)
-      pathIterate (bestLogLike, bestSource, bestTransIndex, state.incoming, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
-    pathIterate (bestLogLike, bestSource, bestTransIndex, state.incoming, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
-    const MachineTransition& bestTrans = m.state[bestSource].getTransition (bestTransIndex);
+      pathIterate (bestLogLike, bestSource, bestTransIndex, bestInTok, bestOutTok, s, InputTokenizer::emptyToken(), outTok, inPos, outPos - 1);
+    pathIterate (bestLogLike, bestSource, bestTransIndex, bestInTok, bestOutTok, s, InputTokenizer::emptyToken(), OutputTokenizer::emptyToken(), inPos, outPos);
+    const MachineTransition bestTrans = m
+      ? m->state[bestSource].getTransition (bestTransIndex)
+      : MachineTransition (this->machine.inputTokenizer.tok2sym[bestInTok], this->machine.outputTokenizer.tok2sym[bestOutTok], s, WeightExpr());
     if (!bestTrans.inputEmpty()) --inPos;
     if (!bestTrans.outputEmpty()) --outPos;
     s = bestSource;
@@ -57,3 +61,6 @@ MachinePath ViterbiMatrix::path (const Machine& m) const {
   }
   return path;
 }
+
+template class ViterbiMatrix<float>;
+template class ViterbiMatrix<double>;
@@ -3,23 +3,37 @@
 
 #include "dpmatrix.h"
 
-class ViterbiMatrix : public DPMatrix {
+template<class Cell>
+class ViterbiMatrix : public DPMatrix<Cell> {
+public:
+  typedef typename DPMatrix<Cell>::InputIndex InputIndex;
+  typedef typename DPMatrix<Cell>::OutputIndex OutputIndex;
+
 private:
-  inline void pathIterate (double& bestLogLike, StateIndex& bestSource, EvaluatedMachineState::TransIndex& bestTransIndex, const EvaluatedMachineState::InOutStateTransMap& inOutStateTransMap, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
-    auto visit = [&] (StateIndex src, EvaluatedMachineState::TransIndex ti, double tll) {
+  inline void pathIterate (double& bestLogLike, StateIndex& bestSource, EvaluatedMachineState::TransIndex& bestTransIndex, InputToken& bestInTok, OutputToken& bestOutTok, StateIndex dest, InputToken inTok, OutputToken outTok, InputIndex inPos, OutputIndex outPos) const {
+    const EvaluatedTransTable& incoming = this->machine.incoming;
+    auto iter = lower_bound (incoming.begin (inTok, outTok), incoming.end (inTok, outTok), dest,
+			     [] (const EvaluatedTrans& t, StateIndex d) { return t.dest < d; });
+    for (auto end = incoming.end (inTok, outTok); iter != end && iter->dest == dest; ++iter) {
+      const double tll = this->cell (inPos, outPos, iter->src) + iter->logWeight;
       if (tll > bestLogLike) {
 	bestLogLike = tll;
-	bestSource = src;
-	bestTransIndex = ti;
+	bestSource = iter->src;
+	bestTransIndex = iter->transIndex;
+	bestInTok = inTok;
+	bestOutTok = outTok;
       }
-    };
-    iterate (inOutStateTransMap, inTok, outTok, inPos, outPos, visit);
+    }
   }
 
 public:
-  ViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair);
+  ViterbiMatrix (const EvaluatedMachine& machine, const SeqPair& seqPair, const DPOptions& options = DPOptions());
   double logLike() const;
-  MachinePath path (const Machine&) const;
+  MachinePath path (const Machine&);  // if checkpointed, refills blocks of rows as the traceback reaches them
+  MachinePath path();  // as above, but for an EvaluatedMachine with no Machine (e.g. a FactoredComposition's): the path's transitions have null weights
+
+private:
+  MachinePath path (const Machine*);
 };
 
 #endif /* VITERBI_INCLUDED */
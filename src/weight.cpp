@@ -127,6 +127,154 @@ WeightExpr WeightAlgebra::bind (const WeightExpr& w, const ParamDefs& defs) {
   return WeightExpr::object ({{op, bindArgs}});
 }
 
+// Constants are only folded into finite values, as infinities and NaNs can't be written as JSON
+static bool isConstant (const WeightExpr& w) {
+  return w.is_null() || w.is_boolean() || w.is_number();
+}
+
+static double constantValue (const WeightExpr& w) {
+  return w.is_number() ? w.get<double>() : (w.is_boolean() && w.get<bool>() ? 1. : 0.);
+}
+
+static WeightExpr constantExpr (double x) {
+  if (x == 0) return WeightExpr();
+  if (x == 1) return WeightExpr(true);
+  if (x == floor(x) && fabs(x) < 1e9) return WeightExpr((int) x);
+  return WeightExpr(x);
+}
+
+// w's factors, with inverted ones (divisors) in den. Leaves are simplified as they are reached, so each chain is flattened once
+static void collectFactors (const WeightExpr& w, bool inverted, double& c, vguard<WeightExpr>& num, vguard<WeightExpr>& den) {
+  const string op = WeightAlgebra::opcode(w);
+  if (op == "*" || op == "/") {
+    const json& args = WeightAlgebra::operands(w);
+    collectFactors (args[0], inverted, c, num, den);
+    collectFactors (args[1], op == "/" ? !inverted : inverted, c, num, den);
+    return;
+  }
+  const WeightExpr f = WeightAlgebra::simplify (w);
+  const string fop = WeightAlgebra::opcode(f);
+  if (fop == "*" || fop == "/")
+    collectFactors (f, inverted, c, num, den);
+  else if (isConstant(f))
+    c = inverted ? c / constantValue(f) : c * constantValue(f);
+  else
+    (inverted ? den : num).push_back (f);
+}
+
+// w's terms, with negated ones (subtrahends) in neg
+static void collectTerms (const WeightExpr& w, bool negated, double& c, vguard<WeightExpr>& pos, vguard<WeightExpr>& neg) {
+  const string op = WeightAlgebra::opcode(w);
+  if (op == "+" || op == "-") {
+    const json& args = WeightAlgebra::operands(w);
+    collectTerms (args[0], negated, c, pos, neg);
+    collectTerms (args[1], op == "-" ? !negated : negated, c, pos, neg);
+    return;
+  }
+  const WeightExpr t = WeightAlgebra::simplify (w);
+  const string top = WeightAlgebra::opcode(t);
+  if (top == "+" || top == "-")
+    collectTerms (t, negated, c, pos, neg);
+  else if (isConstant(t))
+    c = negated ? c - constantValue(t) : c + constantValue(t);
+  else
+    (negated ? neg : pos).push_back (t);
+}
+
+// removes every expression in x that has a structurally identical partner in y, along with that partner
+static void cancelPairs (vguard<WeightExpr>& x, vguard<WeightExpr>& y) {
+  for (auto xi = x.begin(); xi != x.end(); ) {
+    const auto yi = find (y.begin(), y.end(), *xi);
+    if (yi == y.end())
+      ++xi;
+    else {
+      y.erase (yi);
+      xi = x.erase (xi);
+    }
+  }
+}
+
+// w, with its operands simplified but not otherwise changed
+static WeightExpr simplifyOperands (const WeightExpr& w, const string& op) {
+  const json& args = WeightAlgebra::operands(w);
+  return WeightExpr::object ({{op, WeightExpr::array ({WeightAlgebra::simplify (args[0]), WeightAlgebra::simplify (args[1])})}});
+}
+
+WeightExpr WeightAlgebra::simplify (const WeightExpr& w) {
+  const string op = opcode(w);
+  if (op == "null" || op == "boolean" || op == "int" || op == "float" || op == "param")
+    return w;
+  if (op == "log" || op == "exp") {
+    const WeightExpr arg = simplify (w.at(op));
+    if (isConstant(arg)) {
+      const double x = op == "log" ? log (constantValue(arg)) : exp (constantValue(arg));
+      if (isfinite(x))
+	return constantExpr(x);
+    }
+    return op == "log" ? logOf(arg) : expOf(arg);
+  }
+  if (op == "pow") {
+    const json& args = operands(w);
+    const WeightExpr a = simplify (args[0]), b = simplify (args[1]);
+    if (isConstant(a) && isConstant(b)) {
+      const double x = pow (constantValue(a), constantValue(b));
+      if (isfinite(x))
+	return constantExpr(x);
+    }
+    return power (a, b);
+  }
+  if (op == "*" || op == "/") {
+    double c = 1;
+    vguard<WeightExpr> num, den;
+    collectFactors (w, false, c, num, den);
+    if (!isfinite(c))
+      return simplifyOperands (w, op);
+    if (c == 0)
+      return WeightExpr();
+    cancelPairs (num, den);
+    WeightExpr s = constantExpr(c);
+    for (const auto& f: num)
+      s = multiply (s, f);
+    if (den.size()) {
+      WeightExpr d (true);
+      for (const auto& f: den)
+	d = multiply (d, f);
+      s = divide (s, d);
+    }
+    return s;
+  }
+  if (op == "+" || op == "-") {
+    double c = 0;
+    vguard<WeightExpr> pos, neg;
+    collectTerms (w, false, c, pos, neg);
+    if (!isfinite(c))
+      return simplifyOperands (w, op);
+    cancelPairs (pos, neg);
+    WeightExpr s = c > 0 ? constantExpr(c) : WeightExpr();
+    for (const auto& t: pos)
+      s = add (s, t);
+    if (c < 0)
+      neg.push_back (constantExpr(-c));
+    for (const auto& t: neg)
+      s = isZero(s) ? minus(t) : subtract (s, t);
+    return s;
+  }
+  Abort("Unknown opcode: %s", op.c_str());
+  return w;
+}
+
+size_t WeightAlgebra::nodeCount (const WeightExpr& w) {
+  const string op = opcode(w);
+  if (op == "null" || op == "boolean" || op == "int" || op == "float" || op == "param")
+    return 1;
+  if (op == "log" || op == "exp")
+    return 1 + nodeCount (w.at(op));
+  size_t n = 1;
+  for (const auto& arg: operands(w))
+    n += nodeCount (arg);
+  return n;
+}
+
 double WeightAlgebra::eval (const WeightExpr& w, const ParamDefs& defs, const set<string>* excludedDefs) {
   const string op = opcode(w);
   if (op == "null") return 0;
@@ -31,6 +31,11 @@ struct WeightAlgebra {
   static const json& operands (const WeightExpr& w);
 
   static WeightExpr bind (const WeightExpr& w, const ParamDefs& defs);
+
+  // flattens chains of products (and quotients) and of sums (and differences), collects their constant terms,
+  // cancels factors or terms that appear with both signs, removes exp(log(x)) and log(exp(x)), and folds constants
+  static WeightExpr simplify (const WeightExpr& w);
+  static size_t nodeCount (const WeightExpr& w);
   
   static double eval (const WeightExpr& w, const ParamDefs& defs, const set<string>* excludedDefs = NULL);
 
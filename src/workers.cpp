@@ -0,0 +1,65 @@
+#include "workers.h"
+
+WorkerPool::WorkerPool (size_t nThreads, const char* threadName) :
+  job (NULL),
+  jobWorkers (0),
+  jobNumber (0),
+  nBusy (0),
+  stopping (false)
+{
+  for (size_t w = 1; w < nThreads; ++w) {
+    helpers.push_back (thread (&WorkerPool::helperLoop, this, w));
+    logger.nameLastThread (helpers, threadName);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    lock_guard<mutex> lock (mx);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto& helper: helpers) {
+    logger.eraseThreadName (helper);
+    helper.join();
+  }
+}
+
+void WorkerPool::helperLoop (size_t w) {
+  size_t lastJob = 0;
+  unique_lock<mutex> lock (mx);
+  while (true) {
+    cv.wait (lock, [&] () { return stopping || jobNumber != lastJob; });
+    if (stopping)
+      break;
+    lastJob = jobNumber;
+    if (w < jobWorkers) {
+      lock.unlock();
+      (*job) (w);
+      lock.lock();
+    }
+    if (--nBusy == 0)
+      cv.notify_all();
+  }
+}
+
+void WorkerPool::run (size_t nWorkers, const function<void(size_t)>& worker) {
+  Assert (nWorkers <= size(), "Asked for %lu workers from a pool of %lu", nWorkers, size());
+  if (nWorkers <= 1) {
+    if (nWorkers)
+      worker (0);
+    return;
+  }
+  {
+    lock_guard<mutex> lock (mx);
+    job = &worker;
+    jobWorkers = nWorkers;
+    nBusy = helpers.size();
+    ++jobNumber;
+  }
+  cv.notify_all();
+  worker (0);
+  unique_lock<mutex> lock (mx);
+  cv.wait (lock, [&] () { return nBusy == 0; });
+  job = NULL;
+}
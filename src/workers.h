@@ -0,0 +1,85 @@
+#ifndef WORKERS_INCLUDED
+#define WORKERS_INCLUDED
+
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "vguard.h"
+#include "logger.h"
+
+// A fixed set of helper threads that stay alive between jobs, so that a fill made of many short parallel steps does not start and join threads for each one.
+// run(nWorkers,worker) calls worker(w) for w = 0..nWorkers-1, worker 0 on the calling thread and the rest on helpers, and returns when all have finished.
+// Only one thread may call run at a time
+class WorkerPool {
+private:
+  list<thread> helpers;
+  mutex mx;
+  condition_variable cv;
+  const function<void(size_t)>* job;
+  size_t jobWorkers, jobNumber, nBusy;
+  bool stopping;
+  void helperLoop (size_t w);
+public:
+  WorkerPool (size_t nThreads, const char* threadName);  // starts nThreads-1 helpers
+  ~WorkerPool();
+  WorkerPool (const WorkerPool&) = delete;
+  WorkerPool& operator= (const WorkerPool&) = delete;
+  inline size_t size() const { return helpers.size() + 1; }
+  void run (size_t nWorkers, const function<void(size_t)>& worker);
+};
+
+// Runs work(n) for n = 0..nItems-1 on nThreads worker threads, and passes each result to commit(n,result) on the calling thread, in increasing order of n.
+// Workers claim items in order and park their results in a circular reorder buffer of bufSize slots.
+// A worker may not claim item n until item (n - bufSize) has been committed, so at most bufSize results are held at once, however many items there are
+template<class Result, class Work, class Commit>
+void runInOrder (size_t nItems, size_t nThreads, size_t bufSize, const char* threadName, Work work, Commit commit) {
+  vguard<Result> buf (bufSize);
+  vguard<bool> ready (bufSize, false);
+  size_t nextToClaim = 0, nextToCommit = 0;
+  mutex mx;
+  condition_variable cv;
+
+  list<thread> workers;
+  for (size_t w = 0; w < nThreads; ++w) {
+    workers.push_back (thread ([&] () {
+	  unique_lock<mutex> lock (mx);
+	  while (true) {
+	    cv.wait (lock, [&] () { return nextToClaim == nItems || nextToClaim < nextToCommit + bufSize; });
+	    if (nextToClaim == nItems)
+	      break;
+	    const size_t n = nextToClaim++;
+	    lock.unlock();
+	    Result result = work (n);
+	    lock.lock();
+	    swap (buf[n % bufSize], result);
+	    ready[n % bufSize] = true;
+	    cv.notify_all();
+	  }
+	}));
+    logger.nameLastThread (workers, threadName);
+  }
+
+  unique_lock<mutex> lock (mx);
+  while (nextToCommit < nItems) {
+    const size_t n = nextToCommit, slot = n % bufSize;
+    cv.wait (lock, [&] () { return (bool) ready[slot]; });
+    Result result;
+    swap (result, buf[slot]);
+    ready[slot] = false;
+    ++nextToCommit;
+    cv.notify_all();
+    lock.unlock();
+    commit (n, result);
+    lock.lock();
+  }
+  lock.unlock();
+
+  for (auto& worker: workers) {
+    logger.eraseThreadName (worker);
+    worker.join();
+  }
+}
+
+#endif /* WORKERS_INCLUDED */
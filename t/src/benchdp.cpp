@@ -0,0 +1,53 @@
+#include <chrono>
+#include "../../src/backward.h"
+#include "../../src/viterbi.h"
+#include "../../src/scaled.h"
+#include "presetdp.h"
+
+// Times the DP recursions on random sequences of a given length, reporting the cost per cell
+int main (int argc, char** argv) {
+  if (argc < 3 || argc > 5) {
+    cerr << "Usage: " << argv[0] << " preset constraints.json [length] [reps]" << endl;
+    exit(1);
+  }
+  const PresetDP setup (argv[1], argv[2]);
+  const size_t len = argc > 3 ? atoi (argv[3]) : 200;
+  const int reps = argc > 4 ? atoi (argv[4]) : 5;
+  const EvaluatedMachine eval (setup.machine, setup.params);
+  mt19937 rnd (4242);
+  const SeqPair seqPair = setup.randomSeqPair (len, len, rnd);
+
+  const double nCells = (len + 1) * (len + 1) * (double) eval.nStates();
+  auto report = [&] (const char* name, function<double()> run) {
+    double best = numeric_limits<double>::infinity(), ll = 0;
+    for (int r = 0; r < reps; ++r) {
+      const auto start = chrono::steady_clock::now();
+      ll = run();
+      const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      best = min (best, elapsed.count());
+    }
+    cout << argv[1] << "\t" << name << "\t" << (1e9 * best / nCells) << " ns/cell\t(" << best << " s, logLike " << ll << ")" << endl;
+  };
+
+  cout << argv[1] << ": " << eval.nStates() << " states, " << eval.incoming.trans.size() << " transitions, " << len << "*" << len << " residues" << endl;
+  report ("Forward", [&] () { return ForwardMatrix<double> (eval, seqPair).logLike(); });
+  report ("Backward", [&] () { return BackwardMatrix<double> (eval, seqPair).logLike(); });
+  report ("Viterbi", [&] () { return ViterbiMatrix<double> (eval, seqPair).logLike(); });
+  report ("Forward/float", [&] () { return ForwardMatrix<float> (eval, seqPair).logLike(); });
+  report ("Backward/float", [&] () { return BackwardMatrix<float> (eval, seqPair).logLike(); });
+  report ("Viterbi/float", [&] () { return ViterbiMatrix<float> (eval, seqPair).logLike(); });
+  const ForwardMatrix<double> forward (eval, seqPair);
+  const BackwardMatrix<double> backward (eval, seqPair);
+  report ("Counts", [&] () { MachineCounts counts (eval); backward.getCounts (forward, counts); return backward.logLike(); });
+  const ScaledForwardMatrix scaledForward (eval, seqPair);
+  if (scaledForward.underflow)
+    cout << argv[1] << "\tscaled engine underflows" << endl;
+  else {
+    const ScaledBackwardMatrix scaledBackward (scaledForward);
+    report ("Forward/scaled", [&] () { return ScaledForwardMatrix (eval, seqPair).logLike(); });
+    report ("Backward/scaled", [&] () { return ScaledBackwardMatrix (scaledForward).logLike(); });
+    report ("Counts/scaled", [&] () { MachineCounts counts (eval); scaledBackward.getCounts (scaledForward, counts); return scaledBackward.logLike(); });
+  }
+
+  exit(0);
+}
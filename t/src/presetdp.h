@@ -0,0 +1,50 @@
+#ifndef PRESETDP_INCLUDED
+#define PRESETDP_INCLUDED
+
+#include <fstream>
+#include <random>
+#include "../../src/eval.h"
+#include "../../src/seqpair.h"
+#include "../../src/preset.h"
+#include "../../src/constraints.h"
+
+// Shared setup for the DP tests and benchmarks that run a preset on random sequences:
+// the preset with its silent transitions eliminated, the default parameters of a constraints file, with any parameter they leave out set to 0.5,
+// and random sequences over the machine's alphabets
+struct PresetDP {
+  Machine machine;
+  Params params;
+
+  PresetDP (const char* preset, const char* constraintsFilename) :
+    machine (MachinePresets::makePreset (preset).eliminateSilentTransitions())
+  {
+    ifstream consFile (constraintsFilename);
+    if (!consFile)
+      Fail ("File not found: %s", constraintsFilename);
+    json cj;
+    consFile >> cj;
+    const Constraints cons = JsonLoader<Constraints>::fromJson (cj.is_array() ? cj[0] : cj);
+    params = cons.defaultParams();
+    for (const auto& ms: machine.state)
+      for (const auto& t: ms.trans)
+	for (const auto& p: WeightAlgebra::params (t.weight, ParamDefs()))
+	  if (!params.defs.count (p))
+	    params.defs[p] = .5;
+  }
+
+  // the input is sampled before the output
+  SeqPair randomSeqPair (size_t inLen, size_t outLen, mt19937& rnd) const {
+    const auto inAlph = machine.inputAlphabet();
+    const auto outAlph = machine.outputAlphabet();
+    SeqPair seqPair;
+    seqPair.input.name = "input";
+    seqPair.output.name = "output";
+    for (size_t n = 0; n < inLen; ++n)
+      seqPair.input.seq.push_back (inAlph[rnd() % inAlph.size()]);
+    for (size_t n = 0; n < outLen; ++n)
+      seqPair.output.seq.push_back (outAlph[rnd() % outAlph.size()]);
+    return seqPair;
+  }
+};
+
+#endif /* PRESETDP_INCLUDED */
@@ -0,0 +1,35 @@
+#include <random>
+#include <sstream>
+#include "../../src/machine.h"
+#include "../../src/preset.h"
+
+// Composes a random sequence generator with a preset, serially and with several threads, failing unless the results are identical
+int main (int argc, char** argv) {
+  if (argc != 4) {
+    cerr << "Usage: " << argv[0] << " preset length threads" << endl;
+    exit(1);
+  }
+  const Machine machine = MachinePresets::makePreset (argv[1]);
+  const size_t len = atoi (argv[2]);
+  const size_t threads = atoi (argv[3]);
+
+  mt19937 rnd (4242);
+  const auto inAlph = machine.inputAlphabet();
+  vguard<OutputSymbol> seq;
+  for (size_t n = 0; n < len; ++n)
+    seq.push_back (inAlph[rnd() % inAlph.size()]);
+  const Machine gen = Machine::generator ("seq", seq);
+
+  auto composeJson = [&] (size_t nThreads) -> string {
+    ostringstream out;
+    Machine::compose (gen, machine, true, true, nThreads).writeJson (out);
+    return out.str();
+  };
+  const string serial = composeJson (1), parallel = composeJson (threads);
+  if (serial != parallel) {
+    cout << "Composite machines differ" << endl;
+    exit(1);
+  }
+  cout << "Composite machines are identical" << endl;
+  exit(0);
+}
@@ -2,15 +2,20 @@
 #include "../../src/forward.h"
 
 int main (int argc, char** argv) {
-  if (argc != 4) {
-    cerr << "Usage: " << argv[0] << " machine.json params.json seqs.json" << endl;
+  if (argc != 4 && argc != 6) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json seqs.json [wavefrontThreads tileSize]" << endl;
     exit(1);
   }
   Machine machine = MachineLoader::fromFile (argv[1]);
   Params params = JsonLoader<ParamAssign>::fromFile (argv[2]);
   SeqPair seqpair = JsonLoader<SeqPair>::fromFile (argv[3]);
   EvaluatedMachine evalMachine (machine, params);
-  ForwardMatrix forward (evalMachine, seqpair);
+  DPOptions options;
+  if (argc == 6) {
+    options.threads = atoi (argv[4]);
+    options.tileSize = atoi (argv[5]);
+  }
+  ForwardMatrix<double> forward (evalMachine, seqpair, options);
   forward.writeJson (cout);
   exit(0);
 }
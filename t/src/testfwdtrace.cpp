@@ -0,0 +1,88 @@
+#include <random>
+#include "../../src/nano/caller.h"
+#include "../../src/nano/fwdtrace.h"
+#include "../../src/nano/backtrace.h"
+#include "../../src/counts.h"
+
+// Runs Forward-Backward on a random trace under a BaseCallingMachine, filling columns in probability space (fillColumnScaled) and in log space,
+// with and without checkpointing, and fails if any log-likelihood, transition count or Gaussian count differs from the log-space full DP by more than maxDiff
+// (counts are compared relative to their magnitude, or absolutely if it is below 1).
+// The Makefile builds this test against objects compiled with LOG_SUM_EXP_SLOW: the lookup table would put the log-space fill around 1e-4 nats off the exact sum over a few hundred columns
+struct TraceCounts {
+  double logLike;
+  vguard<vguard<double> > count;
+  vguard<GaussianCounts> gaussCounts;
+};
+
+// exposes the constructor that can switch off fillColumnScaled
+struct TestForwardTraceMatrix : ForwardTraceMatrix<double> {
+  TestForwardTraceMatrix (const EvaluatedMachine& eval, const GaussianModelParams& modelParams, const TraceMoments& moments, const TraceParams& traceParams, size_t blockBytes, bool scaled) :
+    ForwardTraceMatrix<double> (eval, modelParams, moments, traceParams, blockBytes, 1, scaled)
+  { }
+};
+
+TraceCounts fillTrace (const EvaluatedMachine& eval, const BaseCallingParams& bcp, const TraceMoments& moments, const TraceParams& traceParams, size_t blockBytes, bool scaled) {
+  TestForwardTraceMatrix forward (eval, bcp.params, moments, traceParams, blockBytes, scaled);
+  MachineCounts counts (eval);
+  vguard<GaussianCounts> gaussCounts (eval.outputTokenizer.tok2sym.size() - 1);
+  const BackwardTraceMatrix<double> backward (forward, &counts, &gaussCounts);
+  TraceCounts tc;
+  tc.logLike = forward.logLike;
+  tc.count = counts.count;
+  tc.gaussCounts = gaussCounts;
+  return tc;
+}
+
+double relDiff (double x, double y) {
+  return fabs (x - y) / max (1., fabs (x));
+}
+
+int main (int argc, char** argv) {
+  if (argc != 6) {
+    cerr << "Usage: " << argv[0] << " kmerLen components traceLength blockBytes maxDiff" << endl;
+    exit(1);
+  }
+  const int kmerLen = atoi (argv[1]), components = atoi (argv[2]), traceLen = atoi (argv[3]);
+  const size_t blockBytes = atol (argv[4]);
+  const double maxDiff = atof (argv[5]);
+  cerr.precision(17);
+
+  BaseCallingMachine machine;
+  machine.init ("ACGT", kmerLen, components);
+  BaseCallingParams bcp;
+  bcp.init ("ACGT", kmerLen, components);
+  mt19937 rnd (42);
+  normal_distribution<double> noise (0, 10);
+  for (auto& g: bcp.params.gauss)
+    g.second.mu = 100 + noise (rnd);
+  TraceParams traceParams;
+  Trace trace;
+  for (int n = 0; n < traceLen; ++n)
+    trace.sample.push_back (100 + noise (rnd));
+  const TraceMoments moments (trace);
+  const EvaluatedMachine eval (machine, bcp.params.params (traceParams.rate));
+
+  const TraceCounts ref = fillTrace (eval, bcp, moments, traceParams, 0, false);
+  bool ok = true;
+  for (size_t bytes: vguard<size_t> { 0, blockBytes })
+    for (bool scaled: { false, true }) {
+      if (bytes == 0 && !scaled)
+	continue;
+      const TraceCounts tc = fillTrace (eval, bcp, moments, traceParams, bytes, scaled);
+      double countDiff = 0, gaussDiff = 0;
+      for (StateIndex s = 0; s < eval.nStates(); ++s)
+	for (size_t t = 0; t < ref.count[s].size(); ++t)
+	  countDiff = max (countDiff, relDiff (ref.count[s][t], tc.count[s][t]));
+      for (size_t n = 0; n < ref.gaussCounts.size(); ++n) {
+	gaussDiff = max (gaussDiff, relDiff (ref.gaussCounts[n].m0, tc.gaussCounts[n].m0));
+	gaussDiff = max (gaussDiff, relDiff (ref.gaussCounts[n].m1, tc.gaussCounts[n].m1));
+	gaussDiff = max (gaussDiff, relDiff (ref.gaussCounts[n].m2, tc.gaussCounts[n].m2));
+      }
+      const double logLikeDiff = fabs (ref.logLike - tc.logLike);
+      cerr << (scaled ? "Scaled" : "Log-space") << " columns, " << (bytes ? "checkpointed" : "full") << ": log-likelihood " << tc.logLike << " (log-space full DP " << ref.logLike << "); largest transition count difference " << countDiff << ", largest Gaussian count difference " << gaussDiff << endl;
+      if (!(logLikeDiff <= maxDiff && countDiff <= maxDiff && gaussDiff <= maxDiff))
+	ok = false;
+    }
+  cout << (ok ? "Log-likelihood and counts match" : "Log-likelihood or counts differ") << endl;
+  exit (ok ? 0 : 1);
+}
@@ -0,0 +1,19 @@
+#include <iomanip>
+#include "../../src/logsumexp.h"
+
+// Sums a vector of log-probabilities with log_sum_exp_batch, and with log_sum_exp_slow term by term
+int main (int argc, char** argv) {
+  if (argc != 2) {
+    cerr << "Usage: " << argv[0] << " length" << endl;
+    exit(1);
+  }
+  const int len = atoi (argv[1]);
+  vguard<double> x;
+  for (int n = 0; n < len; ++n)
+    x.push_back (n % 5 == 4 ? -numeric_limits<double>::infinity() : (-n * .37 - 3));
+  double slow = -numeric_limits<double>::infinity();
+  for (double lp: x)
+    log_accum_exp_slow (slow, lp);
+  cout << setprecision(10) << log_sum_exp_batch (x.data(), x.size()) << endl << slow << endl;
+  exit(0);
+}
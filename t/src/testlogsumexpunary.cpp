@@ -0,0 +1,53 @@
+#include <chrono>
+#include <functional>
+#include <random>
+#include <algorithm>
+#include "../../src/logsumexp.h"
+
+#define LOG_SUM_EXP_UNARY_POLY_MAX_ERROR 2e-15
+
+// Compares log_sum_exp_unary_poly against log_sum_exp_unary_slow on a grid over [0,xmax], failing if the documented error bound is exceeded.
+// Also reports the time per call of log_sum_exp_unary_slow, log_sum_exp_unary (as built) and log_sum_exp_unary_poly on standard error,
+// visiting the grid in random order as the DP does
+int main (int argc, char** argv) {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " xmax steps" << endl;
+    exit(1);
+  }
+  const double xmax = atof (argv[1]);
+  const int steps = atoi (argv[2]);
+  vguard<double> x (steps + 1), result (steps + 1);
+  for (int n = 0; n <= steps; ++n)
+    x[n] = xmax * n / steps;
+
+  double maxErr = 0, maxErrX = 0;
+  for (double xi: x) {
+    const double err = fabs (log_sum_exp_unary_poly (xi) - log_sum_exp_unary_slow (xi));
+    if (err > maxErr) {
+      maxErr = err;
+      maxErrX = xi;
+    }
+  }
+
+  vguard<double> shuffled (x);
+  mt19937 rnd (4242);
+  shuffle (shuffled.begin(), shuffled.end(), rnd);
+  auto time = [&] (const char* name, function<double(double)> f) {
+    const auto start = chrono::steady_clock::now();
+    for (size_t n = 0; n < shuffled.size(); ++n)
+      result[n] = f (shuffled[n]);
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cerr << name << ": " << (1e9 * elapsed.count() / shuffled.size()) << " ns/call" << endl;
+  };
+  time ("log_sum_exp_unary_slow", [] (double x) { return log_sum_exp_unary_slow (x); });
+  time ("log_sum_exp_unary", [] (double x) { return log_sum_exp_unary (x); });
+  time ("log_sum_exp_unary_poly", [] (double x) { return log_sum_exp_unary_poly (x); });
+
+  cerr << "log_sum_exp_unary_poly: max error " << maxErr << " at x = " << maxErrX << endl;
+  if (maxErr > LOG_SUM_EXP_UNARY_POLY_MAX_ERROR) {
+    cout << "log_sum_exp_unary_poly error " << maxErr << " at x = " << maxErrX << " exceeds " << LOG_SUM_EXP_UNARY_POLY_MAX_ERROR << endl;
+    exit(1);
+  }
+  cout << "log_sum_exp_unary_poly error < " << LOG_SUM_EXP_UNARY_POLY_MAX_ERROR << endl;
+  exit(0);
+}
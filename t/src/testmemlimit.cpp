@@ -0,0 +1,35 @@
+#include <fstream>
+#include "../../src/counts.h"
+
+// Compares Forward-Backward with a memory limit (checkpointed Forward, rolling Backward) against the full DP for each sequence pair,
+// failing if the log-likelihoods or counts differ by more than maxDiff
+int main (int argc, char** argv) {
+  if (argc != 6) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json seqpairlist.json blockBytes maxDiff" << endl;
+    exit(1);
+  }
+  const Machine machine = MachineLoader::fromFile (argv[1]);
+  const Params params = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  const SeqPairList seqPairs = JsonLoader<SeqPairList>::fromFile (argv[3]);
+  const EvaluatedMachine eval (machine, params);
+  DPOptions limitOptions;
+  limitOptions.blockBytes = atol (argv[4]);
+  const double maxDiff = atof (argv[5]);
+
+  bool ok = true;
+  for (const auto& seqPair: seqPairs.seqPairs) {
+    MachineCounts fullCounts (eval), limitCounts (eval);
+    const double logLike = fullCounts.add (eval, seqPair);
+    const double limitLogLike = limitCounts.add (eval, seqPair, limitOptions);
+    double countDiff = 0;
+    for (StateIndex s = 0; s < eval.nStates(); ++s)
+      for (size_t t = 0; t < fullCounts.count[s].size(); ++t)
+	countDiff = max (countDiff, fabs (fullCounts.count[s][t] - limitCounts.count[s][t]));
+    const double logLikeDiff = fabs (logLike - limitLogLike);
+    cerr << seqPair.input.name << ": log-likelihood " << logLike << " (with memory limit " << limitLogLike << "); largest count difference " << countDiff << endl;
+    if (!(logLikeDiff <= maxDiff && countDiff <= maxDiff))
+      ok = false;
+  }
+  cout << (ok ? "Log-likelihood and counts match" : "Log-likelihood or counts differ") << endl;
+  exit (ok ? 0 : 1);
+}
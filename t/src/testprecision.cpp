@@ -0,0 +1,34 @@
+#include "../../src/backward.h"
+#include "../../src/viterbi.h"
+
+// Fills Forward, Backward and Viterbi matrices with float and double cells, failing if any log-likelihood differs by more than maxDrift
+int main (int argc, char** argv) {
+  if (argc != 5) {
+    cerr << "Usage: " << argv[0] << " machine.json params.json seqpairlist.json maxDrift" << endl;
+    exit(1);
+  }
+  Machine machine = MachineLoader::fromFile (argv[1]);
+  Params params = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  SeqPairList seqPairList = JsonLoader<SeqPairList>::fromFile (argv[3]);
+  const double maxDrift = atof (argv[4]);
+  EvaluatedMachine evalMachine (machine, params);
+  double fwdDrift = 0, backDrift = 0, vitDrift = 0;
+  for (const auto& seqPair: seqPairList.seqPairs) {
+    fwdDrift = max (fwdDrift, fabs (ForwardMatrix<float> (evalMachine, seqPair).logLike() - ForwardMatrix<double> (evalMachine, seqPair).logLike()));
+    backDrift = max (backDrift, fabs (BackwardMatrix<float> (evalMachine, seqPair).logLike() - BackwardMatrix<double> (evalMachine, seqPair).logLike()));
+    vitDrift = max (vitDrift, fabs (ViterbiMatrix<float> (evalMachine, seqPair).logLike() - ViterbiMatrix<double> (evalMachine, seqPair).logLike()));
+  }
+  cerr << "Forward drift " << fwdDrift << ", Backward drift " << backDrift << ", Viterbi drift " << vitDrift << endl;
+  bool ok = true;
+  auto report = [&] (const char* name, double drift) {
+    if (drift > maxDrift) {
+      cout << name << " log-likelihood drift " << drift << " exceeds " << maxDrift << endl;
+      ok = false;
+    } else
+      cout << name << " log-likelihood drift <= " << maxDrift << endl;
+  };
+  report ("Forward", fwdDrift);
+  report ("Backward", backDrift);
+  report ("Viterbi", vitDrift);
+  exit (ok ? 0 : 1);
+}
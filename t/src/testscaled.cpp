@@ -0,0 +1,37 @@
+#include "../../src/scaled.h"
+#include "presetdp.h"
+
+// Compares the scaled probability-space Forward-Backward with the log-space one on random sequences of the given lengths,
+// reporting whether the scaled engine underflowed, and failing if the log-likelihoods or counts differ by more than maxDiff
+int main (int argc, char** argv) {
+  if (argc != 6) {
+    cerr << "Usage: " << argv[0] << " preset constraints.json inLen outLen maxDiff" << endl;
+    exit(1);
+  }
+  const PresetDP setup (argv[1], argv[2]);
+  const size_t inLen = atoi (argv[3]), outLen = atoi (argv[4]);
+  const double maxDiff = atof (argv[5]);
+  const EvaluatedMachine eval (setup.machine, setup.params);
+  mt19937 rnd (4242);
+  const SeqPair seqPair = setup.randomSeqPair (inLen, outLen, rnd);
+
+  const ScaledForwardMatrix forward (eval, seqPair);
+  const bool underflow = forward.underflow || ScaledBackwardMatrix(forward).underflow;
+  cout << (underflow ? "Scaled engine underflowed" : "Scaled engine did not underflow") << endl;
+
+  DPOptions scaledOptions;
+  scaledOptions.scaled = true;
+  MachineCounts logCounts (eval), scaledCounts (eval);
+  const double logLike = logCounts.add (eval, seqPair);
+  const double scaledLogLike = scaledCounts.add (eval, seqPair, scaledOptions);
+  double countDiff = 0;
+  for (StateIndex s = 0; s < eval.nStates(); ++s)
+    for (size_t t = 0; t < logCounts.count[s].size(); ++t)
+      countDiff = max (countDiff, fabs (logCounts.count[s][t] - scaledCounts.count[s][t]));
+  const double logLikeDiff = fabs (logLike - scaledLogLike);
+  cerr << "Log-likelihood " << logLike << ", difference " << logLikeDiff << "; largest count difference " << countDiff << endl;
+
+  const bool ok = logLikeDiff <= maxDiff && countDiff <= maxDiff;
+  cout << (ok ? "Log-likelihood and counts match" : "Log-likelihood or counts differ") << endl;
+  exit (ok ? 0 : 1);
+}
@@ -0,0 +1,37 @@
+#include <fstream>
+#include "../../src/params.h"
+#include "../../src/schema.h"
+#include "../../src/tape.h"
+
+// Evaluates an expression via a compiled tape, with every parameter in a slot, or (if a parameter is named) its derivative by reverse-mode differentiation,
+// failing if that differs from the symbolic derivative (WeightAlgebra::deriv) by more than 1e-12 relative to its magnitude
+int main (int argc, char** argv) {
+  if (argc != 3 && argc != 4) {
+    cerr << "Usage: " << argv[0] << " expr.json params.json [param]" << endl;
+    exit(1);
+  }
+  json w;
+  ifstream in (argv[1]);
+  in >> w;
+  MachineSchema::validateOrDie ("expr", w);
+  Params p = JsonLoader<ParamAssign>::fromFile (argv[2]);
+  const set<string> params = WeightAlgebra::params (w, ParamDefs());
+  const vguard<string> paramName (params.begin(), params.end());
+  vguard<double> paramValue;
+  for (const auto& n: paramName)
+    paramValue.push_back (p.defs.at(n).get<double>());
+  WeightTape tape (ParamDefs(), paramName);
+  tape.compile (w);
+  if (argc == 4) {
+    vguard<double> grad;
+    tape.gradient (paramValue, grad);
+    const auto iter = find (paramName.begin(), paramName.end(), string (argv[3]));
+    const double tapeDeriv = iter == paramName.end() ? 0. : grad[iter - paramName.begin()];
+    const double symDeriv = WeightAlgebra::eval (WeightAlgebra::deriv (w, ParamDefs(), string (argv[3])), p.defs);
+    if (!(fabs (tapeDeriv - symDeriv) <= 1e-12 * max (1., fabs (symDeriv))))
+      Fail ("Tape derivative %.17g differs from symbolic derivative %.17g", tapeDeriv, symDeriv);
+    cout << tapeDeriv << endl;
+  } else
+    cout << tape.eval (paramValue) << endl;
+  exit(0);
+}
@@ -5,6 +5,7 @@
 #include <random>
 #include <deque>
 #include <boost/program_options.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "../src/vguard.h"
 #include "../src/logger.h"
@@ -15,7 +16,7 @@
 #include "../src/constraints.h"
 #include "../src/params.h"
 #include "../src/fitter.h"
-#include "../src/viterbi.h"
+#include "../src/aligner.h"
 #include "../src/util.h"
 #include "../src/schema.h"
 
@@ -51,6 +52,8 @@ int main (int argc, char** argv) {
       ("revcomp,r", "reverse-complement '~'")
       ("flip,f", "flip input/output")
       ("eliminate,n", "eliminate silent transitions")
+      ("bypass", po::value<double>(), "bypass silent states, where that multiplies their transitions by at most this factor")
+      ("minimize", "merge equivalent states")
       ;
 
     po::options_description postfixOpts("Postfix operators");
@@ -85,6 +88,15 @@ int main (int argc, char** argv) {
       ("data,D", po::value<vector<string> >(), "load sequence-pairs")
       ("train,T", "Baum-Welch parameter fit")
       ("align,A", "Viterbi sequence alignment")
+      ("simplify", "simplify transition weight expressions before saving or using the machine")
+      ("factored", "for --train or --align, keep the last composition as pairs of component transitions, without building its transition weight expressions")
+      ("threads,N", po::value<int>()->default_value(1), "number of threads for composition, --train and --align")
+      ("band", po::value<int>(), "only fill DP cells within this many residues of the main diagonal")
+      ("xdrop", po::value<double>(), "skip DP cells reachable only from cells scoring this far (in nats) below the best in their column")
+      ("memlimit,L", po::value<size_t>(), "approximate memory limit for --train and --align DP (rows between checkpoints are recomputed when needed)")
+      ("wavefront", "use threads to fill each DP matrix (for long sequences), rather than to process several sequence pairs at once")
+      ("precision", po::value<string>()->default_value("double"), "precision of stored DP cells for --train and --align (float|double)")
+      ("engine", po::value<string>()->default_value("log"), "Forward-Backward engine for --train (log|scaled); scaled works in probability space, falling back to log space on underflow")
       ;
 
     po::options_description transOpts("");
@@ -124,6 +136,9 @@ int main (int argc, char** argv) {
     }
     logger.parseLogArgs (vm);
 
+    const int threads = vm.at("threads").as<int>();
+    Require (threads > 0, "Number of threads must be positive");
+
     // create transducer
     list<Machine> machines;
     auto reduceMachines = [&]() -> Machine {
@@ -131,7 +146,7 @@ int main (int argc, char** argv) {
       do {
 	machines.pop_back();
 	if (machines.size())
-	  machine = Machine::compose (machines.back(), machine);
+	  machine = Machine::compose (machines.back(), machine, true, true, threads);
       } while (machines.size());
       return machine;
     };
@@ -198,8 +213,15 @@ int main (int argc, char** argv) {
 	} else if (command == "--accept") {
 	  const NamedOutputSeq outSeq = JsonLoader<NamedOutputSeq>::fromFile (getArg());
 	  m = Machine::acceptor (outSeq.name, outSeq.seq);
-	} else if (command == "--compose")
-	  m = Machine::compose (popMachine(), nextMachine());
+	} else if (command == "--compose") {
+	  const Machine first = popMachine();
+	  m = nextMachine();
+	  // with --factored, the last top-level composition is left to the final reduction, which keeps it factored
+	  if (vm.count("factored") && lastCommand.empty() && args.empty())
+	    machines.push_back (first);
+	  else
+	    m = Machine::compose (first, m, true, true, threads);
+	}
 	else if (command == "--concat")
 	  m = Machine::concatenate (popMachine(), nextMachine());
 	else if (command == "--and")
@@ -216,6 +238,20 @@ int main (int argc, char** argv) {
 	  m = Machine::kleeneLoop (popMachine(), nextMachine());
 	else if (command == "--eliminate")
 	  m = nextMachine().eliminateSilentTransitions();
+	else if (command == "--bypass") {
+	  // checked the same way as the --bypass option's declared type
+	  const string growthArg = getArg();
+	  double maxGrowth = 0;
+	  try {
+	    maxGrowth = boost::lexical_cast<double> (growthArg);
+	  } catch (const boost::bad_lexical_cast&) {
+	    Fail ("--bypass needs a number, not %s", growthArg.c_str());
+	  }
+	  Require (maxGrowth >= 0, "--bypass needs a factor of at least 0, not %s", growthArg.c_str());
+	  m = nextMachine().eliminateSilentStates (maxGrowth);
+	}
+	else if (command == "--minimize")
+	  m = nextMachine().minimize();
 	else if (command == "--reverse")
 	  m = nextMachine().reverse();
 	else if (command == "--revcomp") {
@@ -272,7 +308,24 @@ int main (int argc, char** argv) {
       cout << "Please specify a transducer" << endl;
       return 1;
     }
-    const Machine machine = reduceMachines();
+    Require (!vm.count("factored") || ((vm.count("train") || vm.count("align")) && !vm.count("save")), "--factored requires --train or --align, and can't be used with --save");
+    auto simplify = [&] (const Machine& m) -> Machine {
+      return vm.count("simplify") ? m.simplifyWeights() : m;
+    };
+    Machine machine;
+    shared_ptr<const FactoredComposition> factored;
+    if (vm.count("factored") && machines.size() > 1) {
+      const Machine second = simplify (machines.back());
+      machines.pop_back();
+      const Machine first = simplify (reduceMachines());
+      factored = make_shared<const FactoredComposition> (first, second);
+      if (!factored->advancing) {
+	LogThisAt(1,"Warning: can't keep the composition factored; building the composite machine" << endl);
+	factored.reset();
+	machine = Machine::compose (first, second, true, true, threads);
+      }
+    } else
+      machine = simplify (reduceMachines());
     
     // save transducer
     if (vm.count("save")) {
@@ -294,6 +347,30 @@ int main (int argc, char** argv) {
     Require (!vm.count("data") || (vm.count("train") || vm.count("align")), "Can't specify --data without --train or --align");
     Require (!vm.count("constraints") || vm.count("train"), "Can't specify --constraints without --train");
 
+    DPOptions dpOptions;
+    if (vm.count("band")) {
+      dpOptions.bandWidth = vm.at("band").as<int>();
+      Require (dpOptions.bandWidth > 0, "Band width must be positive");
+    }
+    if (vm.count("xdrop")) {
+      dpOptions.xDrop = vm.at("xdrop").as<double>();
+      Require (dpOptions.xDrop > 0, "X-drop threshold must be positive");
+    }
+    size_t seqPairThreads = threads;
+    if (vm.count("wavefront")) {
+      dpOptions.threads = threads;
+      seqPairThreads = 1;
+    }
+    if (vm.count("memlimit"))
+      dpOptions.blockBytes = vm.at("memlimit").as<size_t>() / seqPairThreads;
+    const string precision = vm.at("precision").as<string>();
+    Require (precision == "float" || precision == "double", "Precision must be float or double");
+    dpOptions.singlePrecision = (precision == "float");
+    const string engine = vm.at("engine").as<string>();
+    Require (engine == "log" || engine == "scaled", "Engine must be log or scaled");
+    dpOptions.scaled = (engine == "scaled");
+    Require (!dpOptions.scaled || !(vm.count("xdrop") || vm.count("memlimit") || dpOptions.singlePrecision), "The scaled engine can't be used with --xdrop, --memlimit or --precision float");
+
     // fit parameters
     ParamAssign seed;
     if (vm.count("params"))
@@ -313,9 +390,12 @@ int main (int argc, char** argv) {
 	       "To fit parameters, please specify a constraints file and a data file");
       MachineFitter fitter;
       fitter.machine = machine;
+      fitter.factored = factored;
       fitter.constraints = JsonLoader<Constraints>::fromFiles(vm.at("constraints").as<vector<string> >());
       fitter.constants = funcs;
       fitter.seed = vm.count("params") ? seed : fitter.constraints.defaultParams();
+      fitter.threads = seqPairThreads;
+      fitter.dpOptions = dpOptions;
       params = fitter.fit(data);
       cout << JsonLoader<Params>::toJsonString(params) << endl;
     }
@@ -326,16 +406,13 @@ int main (int argc, char** argv) {
 	       "To align sequences, please specify a data file and a parameter file (or fit with --train)");
       if (!vm.count("train"))
 	params = funcs.combine (seed);
-      const EvaluatedMachine eval (machine, params);
-      cout << "[";
-      size_t n = 0;
-      for (const auto& seqPair: data.seqPairs) {
-	const ViterbiMatrix viterbi (eval, seqPair);
-	const MachinePath path = viterbi.path (machine);
-	cout << (n++ ? ",\n " : "");
-	path.writeJson (cout);
-      }
-      cout << "]\n";
+      MachineAligner aligner;
+      aligner.machine = machine;
+      aligner.factored = factored;
+      aligner.params = params;
+      aligner.threads = seqPairThreads;
+      aligner.dpOptions = dpOptions;
+      aligner.align (data, cout);
     }
     
   } catch (const std::exception& e) {
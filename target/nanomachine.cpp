@@ -58,6 +58,7 @@ int main (int argc, char** argv) {
       ("maxeventlen,V", po::value<size_t>()->default_value(4), "max number of samples per event")
       ("memlimit,L", po::value<size_t>()->default_value(1<<30), "approximate memory limit for forward-backward DP")
       ("bandwidth,W", po::value<double>()->default_value(1), "proportion of DP matrix to fill around main diagonal")
+      ("precision", po::value<string>()->default_value("double"), "precision of stored DP cells (float|double)")
       ;
 
     po::options_description appOpts("Data options");
@@ -156,6 +157,10 @@ int main (int argc, char** argv) {
     BaseCallingPrior bcPrior;
     const GaussianModelPrior modelPrior = bcPrior.modelPrior (initParams.alphabet, initParams.kmerLen, initParams.components);
     
+    const string precision = vm.at("precision").as<string>();
+    Require (precision == "float" || precision == "double", "Precision must be float or double");
+    const bool singlePrecision = (precision == "float");
+
     // train model
     BaseCallingParams trainedParams = initParams;
     if (vm.count("fasta")) {
@@ -170,6 +175,7 @@ int main (int argc, char** argv) {
       fitter.fitTrace = !vm.count("no-fit-trace");
       fitter.blockBytes = vm.at("memlimit").as<size_t>() / 2;
       fitter.bandWidth = vm.at("bandwidth").as<double>();
+      fitter.singlePrecision = singlePrecision;
       fitter.fit();
 
       trainedParams.params = fitter.modelParams;
@@ -189,6 +195,7 @@ int main (int argc, char** argv) {
       decoder.traceListParams = traceListParams;
       decoder.fitTrace = !vm.count("no-fit-trace");
       decoder.blockBytes = vm.at("memlimit").as<size_t>();
+      decoder.singlePrecision = singlePrecision;
       writeFastaSeqs (cout, decoder.decode());
 
       traceListParams = decoder.traceListParams;